@@ -0,0 +1,103 @@
+// Traversal benchmark of the binary and wide layouts of the TriMesh BVH.
+//
+//   rtnpr_bench_bvh [mesh.obj] [num_rays]
+//
+// Rays are cast from a sphere around the mesh towards random points in its
+// bounding box, which gives a mix of hits and misses similar to camera rays.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <igl/readOBJ.h>
+
+#include "trimesh.h"
+#include "sampler.hpp"
+#include "meshes.hpp"
+
+namespace {
+
+using namespace rtnpr;
+
+std::vector<Ray> make_rays(const Eigen::MatrixXf &V, int num_rays)
+{
+    const Eigen::Vector3f lo = V.colwise().minCoeff();
+    const Eigen::Vector3f hi = V.colwise().maxCoeff();
+    const Eigen::Vector3f cen = .5f * (lo + hi);
+    const float radius = (hi - lo).norm();
+
+    std::vector<Ray> rays;
+    rays.reserve(num_rays);
+    for (int ii = 0; ii < num_rays; ++ii) {
+        UniformSampler<float> sampler(SamplerType::Random, 0, uint32_t(ii), 0, 0);
+        const float z = 2.f * sampler.sample() - 1.f;
+        const float phi = 2.f * float(M_PI) * sampler.sample();
+        const float rxy = std::sqrt(std::max(0.f, 1.f - z*z));
+        const Eigen::Vector3f org = cen + radius * Eigen::Vector3f(rxy*std::cos(phi), rxy*std::sin(phi), z);
+        Eigen::Vector3f tar;
+        for (int a = 0; a < 3; ++a) { tar[a] = lo[a] + (hi[a] - lo[a]) * sampler.sample(); }
+        rays.emplace_back(org, (tar - org).normalized());
+    }
+    return rays;
+}
+
+void run(const char *name, const Eigen::MatrixXf &V, const Eigen::MatrixXi &F, int num_rays)
+{
+    using clock = std::chrono::steady_clock;
+    const auto rays = make_rays(V, num_rays);
+    auto mesh = TriMesh::create(V, F);
+
+    std::printf("%s: %d triangles, %d rays\n", name, int(F.rows()), num_rays);
+    std::printf("  %-8s %10s %10s %12s %10s %8s %12s\n", "layout", "build_ms", "refit_ms", "node_bytes", "Mrays/s", "hits", "any Mrays/s");
+    for (auto layout: {TriMesh::BvhLayout::Binary, TriMesh::BvhLayout::Wide4, TriMesh::BvhLayout::Wide8}) {
+        mesh->set_bvh_layout(layout == TriMesh::BvhLayout::Binary ? TriMesh::BvhLayout::Wide4 : TriMesh::BvhLayout::Binary);
+        auto t0 = clock::now();
+        mesh->set_bvh_layout(layout);
+        auto t1 = clock::now();
+
+        int hits = 0;
+        for (const auto &ray: rays) {
+            Hit hit;
+            mesh->ray_cast(ray, hit);
+            hits += hit.obj_id >= 0;
+        }
+        auto t2 = clock::now();
+
+        // any-hit queries, as used for shadow rays
+        int occluded = 0;
+        for (const auto &ray: rays) { occluded += mesh->occluded(ray); }
+        auto t3 = clock::now();
+
+        // the vertices do not move, so this never falls back to a rebuild
+        mesh->update_vertices(V);
+        auto t4 = clock::now();
+
+        const double build_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        const double trace_s = std::chrono::duration<double>(t2 - t1).count();
+        const double occluded_s = std::chrono::duration<double>(t3 - t2).count();
+        const double refit_ms = std::chrono::duration<double, std::milli>(t4 - t3).count();
+        const char *label = layout == TriMesh::BvhLayout::Binary ? "binary" : layout == TriMesh::BvhLayout::Wide4 ? "wide4" : "wide8";
+        std::printf("  %-8s %10.1f %10.1f %12zu %10.2f %8d %12.2f\n",
+                    label, build_ms, refit_ms, mesh->bvh_memory(), double(num_rays) / trace_s * 1e-6, hits,
+                    double(num_rays) / occluded_s * 1e-6);
+        if (occluded != hits) { std::fprintf(stderr, "  any-hit queries found %d hits\n", occluded); }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const std::string path = argc > 1 ? argv[1] : "assets/bunny_2k.obj";
+    const int num_rays = argc > 2 ? std::stoi(argv[2]) : 1000000;
+
+    Eigen::MatrixXf V;
+    Eigen::MatrixXi F;
+    if (igl::readOBJ(path, V, F)) { run(path.c_str(), V, F, num_rays); }
+    else { std::fprintf(stderr, "failed to read %s\n", path.c_str()); }
+
+    bench::make_bumpy_sphere(1024, V, F);
+    run("bumpy sphere", V, F, num_rays);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cmath>
+
+#include <Eigen/Dense>
+
+namespace rtnpr::bench {
+
+// displaced UV sphere of unit radius with 2*n*n triangles
+inline void make_bumpy_sphere(int n, Eigen::MatrixXf &V, Eigen::MatrixXi &F)
+{
+    V.resize((n+1)*n, 3);
+    F.resize(2*n*n, 3);
+    for (int ii = 0; ii <= n; ++ii) {
+        const float theta = float(M_PI) * float(ii) / float(n);
+        for (int jj = 0; jj < n; ++jj) {
+            const float phi = 2.f * float(M_PI) * float(jj) / float(n);
+            const float r = 1.f + .05f * std::sin(17.f*theta) * std::cos(13.f*phi);
+            V.row(ii*n+jj) = r * Eigen::Vector3f(std::sin(theta)*std::cos(phi), std::sin(theta)*std::sin(phi), std::cos(theta));
+        }
+    }
+    for (int ii = 0; ii < n; ++ii) {
+        for (int jj = 0; jj < n; ++jj) {
+            const int i0 = ii*n+jj, i1 = ii*n+(jj+1)%n;
+            const int i2 = (ii+1)*n+jj, i3 = (ii+1)*n+(jj+1)%n;
+            F.row(2*(ii*n+jj)+0) = Eigen::Vector3i(i0, i2, i1);
+            F.row(2*(ii*n+jj)+1) = Eigen::Vector3i(i1, i2, i3);
+        }
+    }
+}
+
+} // namespace rtnpr::bench
@@ -0,0 +1,458 @@
+// Benchmarks of the render hot paths, written as JSON to track regressions.
+//
+//   rtnpr_bench [--quick] [--out results.json] [--baseline old.json]
+//
+// Measures BVH builds, scene ray casts (primary, incoherent and shadow rays),
+// the line stencil for several n_aux, path tracing for several depths, BRDF
+// sampling for each material type, the accumulation into the frame buffer and
+// whole RayTracer::step frames, on the bundled bunnies and on procedural
+// meshes. All the rays and samples derive
+// from a fixed seed, so two runs do the same work. --quick uses smaller
+// meshes and images. With --baseline, each result is printed next to the one
+// of the same name in a previous output.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <igl/readOBJ.h>
+
+#include "raytracer.h"
+#include "trimesh.h"
+#include "plane.h"
+#include "linetest.hpp"
+#include "pathtrace.hpp"
+#include "meshes.hpp"
+
+namespace {
+
+using namespace rtnpr;
+
+constexpr uint32_t seed = 0x5eed;
+
+// Makes a result of the timed code look used to the compiler, so that the
+// code computing it is not optimized out.
+template<typename T>
+void escape(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(value) : "memory");
+#else
+    static volatile T sink;
+    sink = value;
+    // read back, otherwise the sink counts as set but unused
+    static_cast<void>(sink);
+#endif
+}
+
+struct Result {
+    std::string name;
+    std::string unit;
+    double value;
+};
+
+class Suite {
+public:
+    bool quick = false;
+
+    // minimum time spent repeating a measurement
+    [[nodiscard]] double min_seconds() const { return quick ? .1 : .5; }
+
+    void add(const std::string &name, const std::string &unit, double value)
+    {
+        std::printf("%-48s %12.3f %s\n", name.c_str(), value, unit.c_str());
+        std::fflush(stdout);
+        m_results.push_back({name, unit, value});
+    }
+
+    // Runs fn until min_seconds() elapsed, after one untimed run, and returns
+    // the average time of a run in seconds. setup runs before each run of fn
+    // and is not timed.
+    double time(const std::function<void()> &fn, const std::function<void()> &setup = {}) const
+    {
+        using clock = std::chrono::steady_clock;
+        if (setup) { setup(); }
+        fn();
+        int runs = 0;
+        double elapsed = 0.;
+        do {
+            if (setup) { setup(); }
+            const auto t0 = clock::now();
+            fn();
+            elapsed += std::chrono::duration<double>(clock::now() - t0).count();
+            ++runs;
+        } while (elapsed < min_seconds());
+        return elapsed / double(runs);
+    }
+
+    bool write_json(const std::string &path) const
+    {
+        std::ofstream ofs(path);
+        if (!ofs) { return false; }
+        ofs << "{\n";
+        ofs << "  \"suite\": \"rtnpr_bench\",\n";
+        ofs << "  \"quick\": " << (quick ? "true" : "false") << ",\n";
+        ofs << "  \"threads\": " << std::thread::hardware_concurrency() << ",\n";
+        ofs << "  \"seed\": " << seed << ",\n";
+        ofs << "  \"results\": [\n";
+        for (size_t ii = 0; ii < m_results.size(); ++ii) {
+            const auto &r = m_results[ii];
+            char value[64];
+            std::snprintf(value, sizeof(value), "%.6g", r.value);
+            // one result per line, which read_baseline relies on
+            ofs << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", \"value\": " << value << "}"
+                << (ii+1 < m_results.size() ? ",\n" : "\n");
+        }
+        ofs << "  ]\n";
+        ofs << "}\n";
+        return bool(ofs);
+    }
+
+    void compare(const std::map<std::string, double> &baseline) const
+    {
+        std::printf("\n%-48s %12s %12s %8s\n", "name", "value", "baseline", "ratio");
+        for (const auto &r: m_results) {
+            const auto it = baseline.find(r.name);
+            if (it == baseline.end() || it->second == 0.) { continue; }
+            std::printf("%-48s %12.3f %12.3f %8.3f\n", r.name.c_str(), r.value, it->second, r.value / it->second);
+        }
+    }
+
+private:
+    std::vector<Result> m_results;
+};
+
+// reads back the results of a previous write_json
+std::map<std::string, double> read_baseline(const std::string &path)
+{
+    std::map<std::string, double> res;
+    std::ifstream ifs(path);
+    std::string line;
+    while (std::getline(ifs, line)) {
+        const auto name = line.find("\"name\": \"");
+        const auto value = line.find("\"value\": ");
+        if (name == std::string::npos || value == std::string::npos) { continue; }
+        const auto begin = name + 9;
+        const auto end = line.find('"', begin);
+        res[line.substr(begin, end - begin)] = std::stod(line.substr(value + 9));
+    }
+    return res;
+}
+
+struct Mesh {
+    std::string name;
+    Eigen::MatrixXf V;
+    Eigen::MatrixXi F;
+    float scale;
+};
+
+std::vector<Mesh> load_meshes(bool quick)
+{
+    std::vector<Mesh> meshes;
+    for (const char *name: {"bunny_309_faces", "bunny_2k"}) {
+        Mesh m{name, {}, {}, .03f};
+        if (igl::readOBJ(std::string("assets/") + name + ".obj", m.V, m.F)) { meshes.push_back(std::move(m)); }
+        else { std::fprintf(stderr, "failed to read assets/%s.obj, run from the repository root\n", name); }
+    }
+    for (int n: quick ? std::vector<int>{128} : std::vector<int>{256, 1024}) {
+        Mesh m{"sphere_" + std::to_string(2*n*n), {}, {}, .5f};
+        bench::make_bumpy_sphere(n, m.V, m.F);
+        meshes.push_back(std::move(m));
+    }
+    return meshes;
+}
+
+// the mesh on the ground plane, as in the viewer
+struct Setup {
+    RayTracer rt;
+    Options opts;
+    std::vector<Material> materials;
+    Camera camera;
+
+    explicit Setup(const Mesh &m)
+    {
+        auto mesh = TriMesh::create(m.V, m.F);
+        mesh->transform->scale = m.scale;
+        mesh->apply_transform();
+        rt.scene.add(mesh);
+        auto plane = Plane::create();
+        plane->mat_id = 1;
+        rt.scene.add(plane);
+        rt.scene.commit();
+        opts.scene.plane = plane;
+        opts.rt.seed = seed;
+        flatten_brdf(opts.scene.brdf, materials);
+    }
+
+    [[nodiscard]] UniformSampler<float> sampler(uint32_t iw, uint32_t ih, uint32_t sample_id) const
+    {
+        return {SamplerType::Random, seed, iw, ih, sample_id};
+    }
+
+    // jittered camera rays over a res x res image
+    [[nodiscard]] std::vector<Ray> primary_rays(int res) const
+    {
+        std::vector<Ray> rays;
+        rays.reserve(res*res);
+        for (int ih = 0; ih < res; ++ih) {
+            for (int iw = 0; iw < res; ++iw) {
+                auto s = sampler(iw, ih, 0);
+                rays.push_back(camera.spawn_ray((float(iw)+s.sample())/float(res), (float(ih)+s.sample())/float(res)));
+            }
+        }
+        return rays;
+    }
+};
+
+void bench_build(Suite &suite, const std::vector<Mesh> &meshes)
+{
+    for (const auto &m: meshes) {
+        std::shared_ptr<TriMesh> mesh;
+        const double t = suite.time([&] { mesh = TriMesh::create(m.V, m.F); });
+        suite.add("bvh_build/" + m.name + "/binary", "ms", 1e3 * t);
+        // wide trees are collapsed from a binary one, which is part of their build
+        for (auto layout: {TriMesh::BvhLayout::Wide4, TriMesh::BvhLayout::Wide8}) {
+            const double tw = suite.time(
+                    [&] { mesh->set_bvh_layout(layout); },
+                    [&] { mesh->set_bvh_layout(TriMesh::BvhLayout::Binary); }
+            );
+            const char *label = layout == TriMesh::BvhLayout::Wide4 ? "wide4" : "wide8";
+            suite.add("bvh_build/" + m.name + "/" + label, "ms", 1e3 * tw);
+        }
+        mesh->set_bvh_layout(TriMesh::BvhLayout::Binary);
+        suite.add("bvh_refit/" + m.name, "ms", 1e3 * suite.time([&] { mesh->update_vertices(m.V); }));
+    }
+}
+
+void bench_ray_cast(Suite &suite, const Mesh &m, int res)
+{
+    Setup setup(m);
+    const auto &scene = setup.rt.scene;
+    const auto primary = setup.primary_rays(res);
+
+    std::vector<Hit> hits(primary.size());
+    const double t_primary = suite.time([&] {
+        for (size_t ii = 0; ii < primary.size(); ++ii) {
+            hits[ii] = Hit();
+            scene.ray_cast(primary[ii], hits[ii]);
+        }
+    });
+    suite.add("ray_cast/" + m.name + "/primary", "Mrays/s", 1e-6 * double(primary.size()) / t_primary);
+
+    // uniformly distributed directions from the primary hits
+    std::vector<Ray> incoherent, shadow;
+    for (size_t ii = 0; ii < primary.size(); ++ii) {
+        if (hits[ii].obj_id < 0) { continue; }
+        auto s = setup.sampler(uint32_t(ii), 0, 1);
+        const float z = 2.f * s.sample() - 1.f;
+        const float phi = 2.f * float(M_PI) * s.sample();
+        const float rxy = std::sqrt(math::max(0.f, 1.f - z*z));
+        incoherent.emplace_back(hits[ii].pos, Eigen::Vector3f(rxy*std::cos(phi), rxy*std::sin(phi), z));
+
+        Eigen::Vector3f wi;
+        setup.opts.scene.light[0]->sample_dir(wi, s);
+        shadow.emplace_back(hits[ii].pos, wi);
+    }
+    if (incoherent.empty()) { return; }
+
+    const double t_incoherent = suite.time([&] {
+        for (const auto &ray: incoherent) {
+            Hit hit;
+            scene.ray_cast(ray, hit);
+        }
+    });
+    suite.add("ray_cast/" + m.name + "/incoherent", "Mrays/s", 1e-6 * double(incoherent.size()) / t_incoherent);
+
+    const double t_shadow = suite.time([&] {
+        for (const auto &ray: shadow) { (void) scene.occluded(ray); }
+    });
+    suite.add("ray_cast/" + m.name + "/shadow", "Mrays/s", 1e-6 * double(shadow.size()) / t_shadow);
+}
+
+void bench_stencil(Suite &suite, const Mesh &m, int res)
+{
+    Setup setup(m);
+    std::vector<Hit> stencil;
+    std::vector<Ray> rays;
+    for (int n_aux: {2, 4, 8, 16}) {
+        setup.opts.flr.n_aux = n_aux;
+        const double t = suite.time([&] {
+            for (int ih = 0; ih < res; ++ih) {
+                for (int iw = 0; iw < res; ++iw) {
+                    auto sampler = setup.sampler(iw, ih, 0);
+                    stencil.assign(n_aux+1, Hit());
+                    // the default line tests, the wireframe
+                    trace_stencil<WireframeTest>(
+                            setup.camera, (float(iw)+.5f)/float(res), (float(ih)+.5f)/float(res),
+                            setup.opts.flr.linewidth/800.f,
+                            setup.rt.scene, rays, stencil, sampler
+                    );
+                    stencil_test<WireframeTest>(setup.rt.scene, stencil, rays, sampler, setup.materials);
+                }
+            }
+        });
+        suite.add("stencil/" + m.name + "/n_aux_" + std::to_string(n_aux), "us/pixel", 1e6 * t / double(res*res));
+    }
+}
+
+void bench_ptrace(Suite &suite, const Mesh &m, int res)
+{
+    Setup setup(m);
+    const auto primary = setup.primary_rays(res);
+    std::vector<Hit> hits(primary.size());
+    for (size_t ii = 0; ii < primary.size(); ++ii) { setup.rt.scene.ray_cast(primary[ii], hits[ii]); }
+
+    for (int depth: {1, 2, 4, 8}) {
+        setup.opts.rt.depth = depth;
+        int paths = 0;
+        const double t = suite.time([&] {
+            paths = 0;
+            for (size_t ii = 0; ii < primary.size(); ++ii) {
+                if (hits[ii].obj_id < 0) { continue; }
+                auto sampler = setup.sampler(uint32_t(ii), 0, 0);
+                Eigen::Vector3f L = Eigen::Vector3f::Zero();
+                kernel::ptrace(primary[ii], hits[ii], setup.rt.scene, 1.f, L, setup.materials, setup.opts, sampler);
+                ++paths;
+            }
+        });
+        if (paths == 0) { return; }
+        suite.add("ptrace/" + m.name + "/depth_" + std::to_string(depth), "us/path", 1e6 * t / double(paths));
+    }
+}
+
+void bench_brdf(Suite &suite)
+{
+    static constexpr const char *type_names[] = {"diffuse", "specular", "glossy", "phong"};
+    // a hemisphere of normals, seen from a fixed direction
+    const int n = 4096;
+    std::vector<Eigen::Vector3f> nrm(n);
+    const Eigen::Vector3f wo = Eigen::Vector3f(.3f, .2f, 1.f).normalized();
+    for (int ii = 0; ii < n; ++ii) {
+        UniformSampler<float> s(SamplerType::Random, seed, uint32_t(ii), 0, 0);
+        const float z = s.sample();
+        const float phi = 2.f*float(M_PI)*s.sample();
+        const float rxy = std::sqrt(1.f-z*z);
+        nrm[ii] = Eigen::Vector3f(rxy*std::cos(phi), rxy*std::sin(phi), z);
+    }
+
+    Options opts;
+    std::vector<Material> materials;
+    flatten_brdf(opts.scene.brdf, materials);
+    for (const auto &mat: materials) {
+        float sum = 0.f;
+        const double t = suite.time([&] {
+            for (int ii = 0; ii < n; ++ii) {
+                UniformSampler<float> sampler(SamplerType::Random, seed, uint32_t(ii), 0, 1);
+                sampler.start_block(SampleBlock::bounce + 1);
+                Eigen::Vector3f wi;
+                float val, pdf;
+                mat.sample(nrm[ii], wo, wi, val, pdf, sampler);
+                sum += val / pdf;
+            }
+        });
+        escape(sum);
+        suite.add("brdf/" + std::string(type_names[int(mat.type)]) + "/sample", "ns/sample", 1e9 * t / double(n));
+    }
+}
+
+void bench_accumulate(Suite &suite, int res)
+{
+    Options opts;
+    FrameBuffer fb;
+    fb.resize(res, res);
+    std::vector<unsigned char> img(res*res*3);
+    // what step does per tile: blend the samples, then resolve the tile
+    const double t = suite.time([&] {
+        for (unsigned int tile_id = 0; tile_id < fb.num_tiles(); ++tile_id) {
+            unsigned int iw0, ih0, iw1, ih1;
+            fb.tile_bounds(tile_id, iw0, ih0, iw1, ih1);
+            auto &tile = fb.tile(tile_id);
+            for (unsigned int ih = ih0; ih < ih1; ++ih) {
+                for (unsigned int iw = iw0; iw < iw1; ++iw) {
+                    const Eigen::Vector3f L(float(iw)/float(res), float(ih)/float(res), .5f);
+                    RayTracer::accumulate(tile, FrameBuffer::local_id(iw, ih), L, .5f, .25f, opts.rt.spp_frame, opts);
+                }
+            }
+            RayTracer::resolve_tile(img, res, tile, iw0, ih0, iw1, ih1, opts);
+        }
+    });
+    suite.add("accumulate/" + std::to_string(res), "ns/pixel", 1e9 * t / double(res*res));
+}
+
+void bench_resolve(Suite &suite, int res)
+{
+    // an empty scene fills the buffers quickly, resolve does not depend on their content
+    RayTracer rt;
+    Options opts;
+    Camera camera;
+    std::vector<unsigned char> img;
+    rt.step(img, res, res, camera, opts);
+    const double t = suite.time([&] { rt.resolve(img, opts); });
+    suite.add("resolve/" + std::to_string(res), "ns/pixel", 1e9 * t / double(res*res));
+}
+
+void bench_step(Suite &suite, const Mesh &m, int res)
+{
+    Setup setup(m);
+    std::vector<unsigned char> img;
+    // keeps accumulating, which is what the viewer does when idle
+    setup.opts.rt.spp = std::numeric_limits<int>::max();
+    const double t = suite.time([&] { setup.rt.step(img, res, res, setup.camera, setup.opts); });
+    suite.add("step/" + m.name + "/" + std::to_string(res), "ms/frame", 1e3 * t);
+
+    setup.opts.flr.line_only = true;
+    setup.rt.reset();
+    const double t_line = suite.time([&] { setup.rt.step(img, res, res, setup.camera, setup.opts); });
+    suite.add("step/" + m.name + "/" + std::to_string(res) + "/line_only", "ms/frame", 1e3 * t_line);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Suite suite;
+    std::string out = "bench_results.json";
+    std::string baseline;
+    for (int ii = 1; ii < argc; ++ii) {
+        const std::string key = argv[ii];
+        if (key == "--quick") { suite.quick = true; }
+        else if (key == "--out" && ii+1 < argc) { out = argv[++ii]; }
+        else if (key == "--baseline" && ii+1 < argc) { baseline = argv[++ii]; }
+        else {
+            std::fprintf(stderr, "usage: rtnpr_bench [--quick] [--out results.json] [--baseline old.json]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    const auto meshes = load_meshes(suite.quick);
+    const int res = suite.quick ? 64 : 256;
+
+    bench_build(suite, meshes);
+    for (const auto &m: meshes) { bench_ray_cast(suite, m, res); }
+    // the line stencil and shading do most of their work on the bunnies
+    for (const auto &m: meshes) {
+        if (m.name.rfind("bunny", 0) != 0) { continue; }
+        bench_stencil(suite, m, res);
+        bench_ptrace(suite, m, res);
+        bench_step(suite, m, res);
+    }
+    bench_brdf(suite);
+    bench_accumulate(suite, suite.quick ? 256 : 1024);
+    bench_resolve(suite, suite.quick ? 256 : 1024);
+
+    if (!suite.write_json(out)) {
+        std::fprintf(stderr, "failed to write %s\n", out.c_str());
+        return EXIT_FAILURE;
+    }
+    std::printf("results written to %s\n", out.c_str());
+    if (!baseline.empty()) { suite.compare(read_baseline(baseline)); }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,284 @@
+// Offline renderer: renders a mesh on the ground plane to a target number of
+// samples per pixel and writes the image, without any window or GPU.
+//
+//   rtnpr_render [options] [mesh.obj]
+//
+//   -o, --output FILE     output image, binary PPM (render.ppm)
+//   --size W H            image size in pixels (800 800)
+//   --scale S             scale applied to the mesh (0.03)
+//   --camera R PHI Z      orbit of the camera around the origin (5 4.712 0.5)
+//   --spp N               samples per pixel (128)
+//   --spp-frame N         samples per pixel traced in each pass (1)
+//   --depth N             path length (4)
+//   --adaptive            stop sampling the pixels that have converged
+//   --target-error E      error at which a pixel converges (0.02)
+//   --min-spp N           samples per pixel before it can converge (16)
+//   --seed N              seed of the sampler (0)
+//   --sampler NAME        random, sobol or bluenoise (sobol)
+//   --linewidth W         feature line width (1)
+//   --n-aux N             auxiliary rays of the line stencil (4)
+//   --share-stencil       share the stencil rays between neighbouring pixels
+//   --adaptive-stencil    trace fewer stencil rays in the pixels far from lines
+//   --line-only           only draw the feature lines
+//   --no-plane            do not add the ground plane
+//   --stats               print the ray counts and the time of each stage
+//   --trace FILE          record the passes and tiles as a Chrome trace
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <igl/readOBJ.h>
+
+#include "raytracer.h"
+#include "trimesh.h"
+#include "plane.h"
+
+namespace {
+
+using namespace rtnpr;
+
+struct Args {
+    std::string mesh = "assets/bunny_2k.obj";
+    std::string output = "render.ppm";
+    unsigned int width = 800;
+    unsigned int height = 800;
+    float scale = .03f;
+    float radius = 5.f;
+    float phi = float(M_PI)*1.5f;
+    float z = .5f;
+    bool plane = true;
+    bool stats = false;
+    std::string trace;
+};
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: rtnpr_render [-o out.ppm] [--size W H] [--scale S] [--camera R PHI Z]\n"
+                 "                    [--spp N] [--spp-frame N] [--depth N] [--seed N]\n"
+                 "                    [--adaptive] [--target-error E] [--min-spp N]\n"
+                 "                    [--sampler random|sobol|bluenoise] [--linewidth W] [--n-aux N]\n"
+                 "                    [--share-stencil] [--adaptive-stencil]\n"
+                 "                    [--line-only] [--no-plane] [--stats] [--trace FILE] [mesh.obj]\n");
+}
+
+bool parse(int argc, char **argv, Args &args, Options &opts)
+{
+    for (int ii = 1; ii < argc; ++ii) {
+        const std::string key = argv[ii];
+        auto value = [&](int k) { return argv[ii + k]; };
+        // the key is followed by n values
+        auto need = [&](int n) {
+            if (ii + n >= argc) {
+                std::fprintf(stderr, "missing value for %s\n", key.c_str());
+                return false;
+            }
+            return true;
+        };
+
+        if (key == "-o" || key == "--output") {
+            if (!need(1)) { return false; }
+            args.output = value(1);
+            ii += 1;
+        } else if (key == "--size") {
+            if (!need(2)) { return false; }
+            args.width = std::stoul(value(1));
+            args.height = std::stoul(value(2));
+            ii += 2;
+        } else if (key == "--scale") {
+            if (!need(1)) { return false; }
+            args.scale = std::stof(value(1));
+            ii += 1;
+        } else if (key == "--camera") {
+            if (!need(3)) { return false; }
+            args.radius = std::stof(value(1));
+            args.phi = std::stof(value(2));
+            args.z = std::stof(value(3));
+            ii += 3;
+        } else if (key == "--spp") {
+            if (!need(1)) { return false; }
+            opts.rt.spp = std::stoi(value(1));
+            ii += 1;
+        } else if (key == "--spp-frame") {
+            if (!need(1)) { return false; }
+            opts.rt.spp_frame = std::stoi(value(1));
+            ii += 1;
+        } else if (key == "--depth") {
+            if (!need(1)) { return false; }
+            opts.rt.depth = std::stoi(value(1));
+            ii += 1;
+        } else if (key == "--adaptive") {
+            opts.rt.adaptive = true;
+        } else if (key == "--target-error") {
+            if (!need(1)) { return false; }
+            opts.rt.target_error = std::stof(value(1));
+            ii += 1;
+        } else if (key == "--min-spp") {
+            if (!need(1)) { return false; }
+            opts.rt.min_spp = std::stoi(value(1));
+            ii += 1;
+        } else if (key == "--seed") {
+            if (!need(1)) { return false; }
+            opts.rt.seed = uint32_t(std::stoul(value(1)));
+            ii += 1;
+        } else if (key == "--sampler") {
+            if (!need(1)) { return false; }
+            const std::string name = value(1);
+            if (name == "random") { opts.rt.sampler = SamplerType::Random; }
+            else if (name == "sobol") { opts.rt.sampler = SamplerType::Sobol; }
+            else if (name == "bluenoise") { opts.rt.sampler = SamplerType::BlueNoise; }
+            else {
+                std::fprintf(stderr, "unknown sampler %s\n", name.c_str());
+                return false;
+            }
+            ii += 1;
+        } else if (key == "--linewidth") {
+            if (!need(1)) { return false; }
+            opts.flr.linewidth = std::stof(value(1));
+            ii += 1;
+        } else if (key == "--n-aux") {
+            if (!need(1)) { return false; }
+            opts.flr.n_aux = std::stoi(value(1));
+            ii += 1;
+        } else if (key == "--share-stencil") {
+            opts.flr.share_stencil = true;
+        } else if (key == "--adaptive-stencil") {
+            opts.flr.adaptive_stencil = true;
+        } else if (key == "--line-only") {
+            opts.flr.line_only = true;
+        } else if (key == "--no-plane") {
+            args.plane = false;
+        } else if (key == "--stats") {
+            args.stats = true;
+        } else if (key == "--trace") {
+            if (!need(1)) { return false; }
+            args.trace = value(1);
+            ii += 1;
+        } else if (key == "-h" || key == "--help") {
+            return false;
+        } else if (!key.empty() && key[0] == '-') {
+            std::fprintf(stderr, "unknown option %s\n", key.c_str());
+            return false;
+        } else {
+            args.mesh = key;
+        }
+    }
+    if (args.width == 0 || args.height == 0 || opts.rt.spp <= 0 || opts.rt.spp_frame <= 0) {
+        std::fprintf(stderr, "size, spp and spp-frame must be positive\n");
+        return false;
+    }
+    if (opts.flr.n_aux < 1 || opts.flr.n_aux > SampleBlock::max_aux) {
+        std::fprintf(stderr, "n-aux must be between 1 and %d\n", SampleBlock::max_aux);
+        return false;
+    }
+    if (opts.rt.depth < 1) {
+        std::fprintf(stderr, "depth must be at least 1\n");
+        return false;
+    }
+    return true;
+}
+
+// the rows of the ray tracer image go from bottom to top
+bool write_ppm(const std::string &path, const std::vector<unsigned char> &img, unsigned int width, unsigned int height)
+{
+    FILE *fp = std::fopen(path.c_str(), "wb");
+    if (!fp) { return false; }
+    std::fprintf(fp, "P6\n%u %u\n255\n", width, height);
+    for (unsigned int ih = height; ih-- > 0;) {
+        std::fwrite(img.data() + size_t(ih)*width*3, 1, size_t(width)*3, fp);
+    }
+    return std::fclose(fp) == 0;
+}
+
+void print_stats(const stats::FrameStats &total)
+{
+    std::printf("%.2f Mrays/s over %u threads\n", total.mrays_per_s(), total.num_threads);
+    for (int c = 0; c < stats::num_counters; ++c) {
+        std::printf("  %-15s %14llu\n", stats::counter_names[c], (unsigned long long) total.counters[c]);
+    }
+    double total_ms = 0.;
+    for (double ms: total.stage_ms) { total_ms += ms; }
+    for (int s = 0; s < stats::num_stages; ++s) {
+        const double share = total_ms > 0. ? 100. * total.stage_ms[s] / total_ms : 0.;
+        std::printf("  %-15s %11.1f ms %5.1f%%\n", stats::stage_names[s], total.stage_ms[s], share);
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    using clock = std::chrono::steady_clock;
+
+    Args args;
+    Options opts;
+    try {
+        if (!parse(argc, argv, args, opts)) {
+            usage();
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception &) {
+        std::fprintf(stderr, "invalid number in the arguments\n");
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    Eigen::MatrixXf V;
+    Eigen::MatrixXi F;
+    if (!igl::readOBJ(args.mesh, V, F) || F.rows() == 0) {
+        std::fprintf(stderr, "failed to read %s\n", args.mesh.c_str());
+        return EXIT_FAILURE;
+    }
+
+    RayTracer rt;
+    auto mesh = TriMesh::create(V, F);
+    mesh->transform->scale = args.scale;
+    mesh->apply_transform();
+    rt.scene.add(mesh);
+
+    // same ground plane as the viewer
+    auto plane = Plane::create();
+    plane->mat_id = 1;
+    plane->visible = args.plane;
+    rt.scene.add(plane);
+    opts.scene.plane = plane;
+
+    Camera camera;
+    camera.set_orbit(args.radius, args.phi, args.z);
+
+    if (!args.trace.empty()) { rt.start_trace(); }
+
+    const auto t0 = clock::now();
+    std::vector<unsigned char> img;
+    stats::FrameStats total;
+    while (rt.spp() < unsigned(opts.rt.spp)) {
+        rt.step(img, args.width, args.height, camera, opts);
+        const auto &frame = rt.stats();
+        for (int c = 0; c < stats::num_counters; ++c) { total.counters[c] += frame.counters[c]; }
+        for (int s = 0; s < stats::num_stages; ++s) { total.stage_ms[s] += frame.stage_ms[s]; }
+        total.frame_ms += frame.frame_ms;
+        total.num_threads = frame.num_threads;
+        // every pixel has converged
+        if (frame.counters[stats::SampledPixels] == 0) { break; }
+    }
+    const auto t1 = clock::now();
+
+    if (!args.trace.empty() && !rt.write_trace(args.trace)) {
+        std::fprintf(stderr, "failed to write %s\n", args.trace.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (!write_ppm(args.output, img, args.width, args.height)) {
+        std::fprintf(stderr, "failed to write %s\n", args.output.c_str());
+        return EXIT_FAILURE;
+    }
+    std::printf("%s: %ux%u, %u spp in %.2fs\n",
+                args.output.c_str(), args.width, args.height, rt.spp(),
+                std::chrono::duration<double>(t1 - t0).count());
+    if (args.stats) { print_stats(total); }
+    return EXIT_SUCCESS;
+}
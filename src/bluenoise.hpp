@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rtnpr_math.hpp"
+
+namespace rtnpr::bluenoise {
+
+constexpr int mask_res = 64;
+
+// Dither mask built with the void-and-cluster method
+// (Ulichney, "The void-and-cluster method for dither array generation", 1993).
+// Returns res*res ranks normalized to (0,1).
+inline std::vector<float> void_and_cluster(int res, float sigma, uint32_t seed)
+{
+    const int n = res * res;
+
+    // toroidal gaussian filter used as the energy of a binary pattern
+    std::vector<float> kernel(n);
+    for (int y = 0; y < res; ++y) {
+        for (int x = 0; x < res; ++x) {
+            const int dx = math::min(x, res-x);
+            const int dy = math::min(y, res-y);
+            kernel[y*res+x] = std::exp(-float(dx*dx+dy*dy) / (2.f*sigma*sigma));
+        }
+    }
+
+    auto toggle = [&](std::vector<uint8_t> &pattern, std::vector<float> &energy, int p, bool on) {
+        pattern[p] = on ? 1 : 0;
+        const float s = on ? 1.f : -1.f;
+        const int px = p % res;
+        const int py = p / res;
+        for (int y = 0; y < res; ++y) {
+            const float *k = &kernel[((y-py+res)%res)*res];
+            float *e = &energy[y*res];
+            for (int x = 0; x < res; ++x) { e[x] += s * k[(x-px+res)%res]; }
+        }
+    };
+
+    auto tightest_cluster = [&](const std::vector<uint8_t> &pattern, const std::vector<float> &energy) {
+        int id = -1;
+        for (int p = 0; p < n; ++p) {
+            if (pattern[p] && (id < 0 || energy[p] > energy[id])) { id = p; }
+        }
+        return id;
+    };
+
+    auto largest_void = [&](const std::vector<uint8_t> &pattern, const std::vector<float> &energy) {
+        int id = -1;
+        for (int p = 0; p < n; ++p) {
+            if (!pattern[p] && (id < 0 || energy[p] < energy[id])) { id = p; }
+        }
+        return id;
+    };
+
+    // random initial pattern, relaxed until swapping the tightest cluster
+    // into the largest void does not move anything
+    std::vector<uint8_t> pattern(n, 0);
+    std::vector<float> energy(n, 0.f);
+    const int m = n / 10;
+    for (int ii = 0, cnt = 0; cnt < m; ++ii) {
+        uint32_t h = seed ^ uint32_t(ii) * 747796405u;
+        h ^= h >> 16; h *= 0x7feb352du; h ^= h >> 15; h *= 0x846ca68bu; h ^= h >> 16;
+        const int p = int(h % uint32_t(n));
+        if (pattern[p]) { continue; }
+        toggle(pattern, energy, p, true);
+        ++cnt;
+    }
+    for (int iter = 0; iter < n; ++iter) {
+        const int c = tightest_cluster(pattern, energy);
+        toggle(pattern, energy, c, false);
+        const int v = largest_void(pattern, energy);
+        toggle(pattern, energy, v, true);
+        if (v == c) { break; }
+    }
+
+    std::vector<int> rank(n);
+    {
+        auto pattern1 = pattern;
+        auto energy1 = energy;
+        for (int r = m-1; r >= 0; --r) {
+            const int c = tightest_cluster(pattern1, energy1);
+            toggle(pattern1, energy1, c, false);
+            rank[c] = r;
+        }
+    }
+    // filling the largest void of the ones is the same as removing the
+    // tightest cluster of the zeros, so this also covers the upper half
+    for (int r = m; r < n; ++r) {
+        const int v = largest_void(pattern, energy);
+        toggle(pattern, energy, v, true);
+        rank[v] = r;
+    }
+
+    std::vector<float> mask(n);
+    for (int p = 0; p < n; ++p) { mask[p] = (float(rank[p]) + .5f) / float(n); }
+    return mask;
+}
+
+inline const std::vector<float> &mask()
+{
+    static const std::vector<float> m = void_and_cluster(mask_res, 1.5f, 0x5eedu);
+    return m;
+}
+
+// Mask value at pixel (ix,iy) for sample dimension dim. Every dimension reads
+// the mask with a different toroidal shift along the R2 sequence so that
+// dimensions stay decorrelated while each keeps the blue-noise spectrum.
+inline float value(uint32_t ix, uint32_t iy, uint32_t dim)
+{
+    const auto ox = uint32_t(float(dim) * 0.7548776662f * float(mask_res));
+    const auto oy = uint32_t(float(dim) * 0.5698402910f * float(mask_res));
+    const uint32_t x = (ix + ox) % mask_res;
+    const uint32_t y = (iy + oy) % mask_res;
+    return mask()[y*mask_res+x];
+}
+
+} // namespace rtnpr::bluenoise
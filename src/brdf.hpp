@@ -1,79 +1,194 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <vector>
+
 #include "rtnpr_math.hpp"
 #include "sampler.hpp"
 
 namespace rtnpr {
 
-class BRDF {
-public:
-    float albedo = .5f;
+// Flat description of a BRDF, so that the kernels reach the materials in a
+// contiguous table and evaluate them with a switch on the type instead of
+// virtual calls. A Phong material mixes a diffuse and a glossy lobe.
+struct Material {
+    enum class Type : uint8_t {
+        Diffuse = 0, Specular = 1, Glossy = 2, Phong = 3
+    };
+    Type type = Type::Diffuse;
     bool reflect_line = false;
+    float albedo = .5f;
+    // Glossy and Phong: exponent of the glossy lobe
+    int power = 0;
+    // Phong: weight of the diffuse lobe, and albedos of the lobes
+    float kd = 0.f;
+    float albedo_d = 1.f;
+    float albedo_g = 1.f;
 
-    explicit BRDF(float _albedo = .5f) : albedo(_albedo) {}
-
-    [[nodiscard]] virtual float eval(
+    [[nodiscard]] float eval(
             const Eigen::Vector3f &nrm,
             const Eigen::Vector3f &wo,
             const Eigen::Vector3f &wi
     ) const {
-        return albedo * math::max(0.f, nrm.dot(wi)) / float(M_PI);
+        float val, pdf;
+        eval_pdf(nrm, reflect(nrm, wo), wi, val, pdf);
+        return val;
     }
 
-    [[nodiscard]] virtual float pdf(
+    [[nodiscard]] float pdf(
             const Eigen::Vector3f &nrm,
             const Eigen::Vector3f &wo,
             const Eigen::Vector3f &wi
     ) const {
-        // cosine-weighted
-        return std::max(0.f,nrm.dot(wi)) / float(M_PI);
+        float val, pdf;
+        eval_pdf(nrm, reflect(nrm, wo), wi, val, pdf);
+        return pdf;
     }
 
-    virtual void sample_dir(
+    // Samples wi, and gives its value and pdf, with the reflection vector
+    // and the power of the glossy lobe worked out once.
+    void sample(
             const Eigen::Vector3f &nrm,
             const Eigen::Vector3f &wo,
             Eigen::Vector3f &wi,
-            float &brdf_val,
+            float &val,
+            float &pdf,
             UniformSampler<float> &sampler
     ) const {
-        using namespace std;
-        using namespace Eigen;
+        const Eigen::Vector3f r = reflect(nrm, wo);
+        switch (type) {
+            case Type::Diffuse: wi = sample_cosine(nrm, sampler); break;
+            case Type::Specular: {
+                wi = r;
+                val = math::max(0.f, wi.dot(nrm)) * albedo;
+                pdf = 1.f;
+                return;
+            }
+            case Type::Glossy: wi = sample_lobe(r, sampler); break;
+            case Type::Phong: {
+                if (sampler.sample_select() < math::clip(kd, 0.f, 1.f)) { wi = sample_cosine(nrm, sampler); }
+                else { wi = sample_lobe(r, sampler); }
+                break;
+            }
+        }
+        eval_pdf(nrm, r, wi, val, pdf);
+    }
+
+private:
+    [[nodiscard]] static Eigen::Vector3f reflect(const Eigen::Vector3f &nrm, const Eigen::Vector3f &wo)
+    {
+        return -wo + 2.f * nrm.dot(wo) * nrm;
+    }
+
+    // value and pdf of wi, r is the reflection of wo
+    void eval_pdf(
+            const Eigen::Vector3f &nrm,
+            const Eigen::Vector3f &r,
+            const Eigen::Vector3f &wi,
+            float &val,
+            float &pdf
+    ) const {
+        const float cos_n = math::max(0.f, nrm.dot(wi));
+        switch (type) {
+            case Type::Diffuse: {
+                val = albedo * cos_n / float(M_PI);
+                pdf = cos_n / float(M_PI);
+                break;
+            }
+            case Type::Specular: {
+                val = 0.f;
+                pdf = 1.f;
+                break;
+            }
+            case Type::Glossy: {
+                const float p = std::pow(math::max(0.f, r.dot(wi)), float(power));
+                val = albedo * .5f * float(power+2) * p / float(M_PI) * cos_n;
+                pdf = .5f * float(power+1) * p / float(M_PI);
+                break;
+            }
+            case Type::Phong: {
+                const float kd_ = math::clip(kd, 0.f, 1.f);
+                const float p = std::pow(math::max(0.f, r.dot(wi)), float(power));
+                const float val_d = albedo_d * cos_n / float(M_PI);
+                const float val_g = albedo_g * .5f * float(power+2) * p / float(M_PI) * cos_n;
+                val = albedo * (kd_ * val_d + (1.f-kd_) * val_g);
+                pdf = kd_ * (cos_n / float(M_PI)) + (1.f-kd_) * (.5f * float(power+1) * p / float(M_PI));
+                break;
+            }
+        }
+    }
 
-        Vector3f b1, b2;
+    // cosine-weighted around nrm
+    [[nodiscard]] static Eigen::Vector3f sample_cosine(const Eigen::Vector3f &nrm, UniformSampler<float> &sampler)
+    {
+        Eigen::Vector3f b1, b2;
         math::create_local_frame(nrm, b1, b2);
 
-        float z = sqrt(math::max(0.f,sampler.sample()));
-        float rxy = sqrt(math::max(0.f,1.f-z*z));
+        float z = std::sqrt(math::max(0.f,sampler.sample()));
+        float rxy = std::sqrt(math::max(0.f,1.f-z*z));
         float phi = 2.f*float(M_PI)*sampler.sample();
-
-        wi = z*nrm + rxy*cos(phi)*b1 + rxy*sin(phi)*b2;
-        brdf_val = eval(nrm, wo, wi);
+        return z*nrm + rxy*std::cos(phi)*b1 + rxy*std::sin(phi)*b2;
     }
 
-private:
+    // around the reflection r, after the power of the glossy lobe
+    [[nodiscard]] Eigen::Vector3f sample_lobe(const Eigen::Vector3f &r, UniformSampler<float> &sampler) const
+    {
+        Eigen::Vector3f b1, b2;
+        math::create_local_frame(r, b1, b2);
+
+        float z = std::pow(math::max(0.f,sampler.sample()), 1.f/float(power+1));
+        float rxy = std::sqrt(math::max(0.f,1.f-z*z));
+        float phi = 2.f*float(M_PI)*sampler.sample();
+        return z*r + rxy*std::cos(phi)*b1 + rxy*std::sin(phi)*b2;
+    }
 };
 
-class SpecularBRDF: public BRDF {
+// The BRDFs are what the options hold and what an application configures;
+// they flatten to a Material, which does the evaluation.
+class BRDF {
 public:
-    SpecularBRDF() {
-        this->reflect_line = true;
-        this->albedo = .5f;
+    float albedo = .5f;
+    bool reflect_line = false;
+
+    explicit BRDF(float _albedo = .5f) : albedo(_albedo) {}
+    virtual ~BRDF() = default;
+
+    [[nodiscard]] virtual Material material() const
+    {
+        Material m;
+        m.type = Material::Type::Diffuse;
+        m.reflect_line = reflect_line;
+        m.albedo = albedo;
+        return m;
     }
 
     [[nodiscard]] float eval(
             const Eigen::Vector3f &nrm,
             const Eigen::Vector3f &wo,
             const Eigen::Vector3f &wi
-    ) const override {
-        return 0.f;
+    ) const {
+        return material().eval(nrm, wo, wi);
     }
 
     [[nodiscard]] float pdf(
             const Eigen::Vector3f &nrm,
             const Eigen::Vector3f &wo,
             const Eigen::Vector3f &wi
-    ) const override {
-        return 1.f;
+    ) const {
+        return material().pdf(nrm, wo, wi);
+    }
+
+    // samples wi with its value and pdf, see Material::sample
+    void sample(
+            const Eigen::Vector3f &nrm,
+            const Eigen::Vector3f &wo,
+            Eigen::Vector3f &wi,
+            float &brdf_val,
+            float &pdf,
+            UniformSampler<float> &sampler
+    ) const {
+        material().sample(nrm, wo, wi, brdf_val, pdf, sampler);
     }
 
     void sample_dir(
@@ -82,68 +197,46 @@ public:
             Eigen::Vector3f &wi,
             float &brdf_val,
             UniformSampler<float> &sampler
-    ) const override {
-        wi = -wo + 2.f * wo.dot(nrm) * nrm;
-        brdf_val = math::max(0.f, wi.dot(nrm)) * this->albedo;
+    ) const {
+        float pdf;
+        sample(nrm, wo, wi, brdf_val, pdf, sampler);
     }
 
 private:
 };
 
-class GlossyBRDF: public BRDF {
+class SpecularBRDF: public BRDF {
 public:
-    int power = 5000;
-
-    GlossyBRDF() {
+    SpecularBRDF() {
         this->reflect_line = true;
         this->albedo = .5f;
     }
 
-    [[nodiscard]] float eval(
-            const Eigen::Vector3f &nrm,
-            const Eigen::Vector3f &wo,
-            const Eigen::Vector3f &wi
-    ) const override {
-        using namespace std;
-        using namespace Eigen;
-        Vector3f r = -wo + 2.f * nrm.dot(wo) * nrm;
-        float c = math::max(0.f, r.dot(wi));
-        float w = this->albedo * .5f * float(power+2) * pow(c, float(power)) / float(M_PI);
-        return w * math::max(0.f, nrm.dot(wi));
-    }
-
-    [[nodiscard]] float pdf(
-            const Eigen::Vector3f &nrm,
-            const Eigen::Vector3f &wo,
-            const Eigen::Vector3f &wi
-    ) const override {
-        using namespace std;
-        using namespace Eigen;
-        Vector3f r = -wo + 2.f * nrm.dot(wo) * nrm;
-        float c = math::max(0.f, r.dot(wi));
-        return .5f * float(power+1) * pow(c,float(power)) / float(M_PI);
+    [[nodiscard]] Material material() const override
+    {
+        Material m = BRDF::material();
+        m.type = Material::Type::Specular;
+        return m;
     }
 
-    void sample_dir(
-            const Eigen::Vector3f &nrm,
-            const Eigen::Vector3f &wo,
-            Eigen::Vector3f &wi,
-            float &brdf_val,
-            UniformSampler<float> &sampler
-    ) const override {
-        using namespace std;
-        using namespace Eigen;
+private:
+};
 
-        Vector3f r = -wo + 2.f * nrm.dot(wo) * nrm;
-        Vector3f b1, b2;
-        math::create_local_frame(r, b1, b2);
+class GlossyBRDF: public BRDF {
+public:
+    int power = 5000;
 
-        float z = pow(math::max(0.f,sampler.sample()), 1.f/float(power+1));
-        float rxy = sqrt(math::max(0.f,1.f-z*z));
-        float phi = 2.f*float(M_PI)*sampler.sample();
+    GlossyBRDF() {
+        this->reflect_line = true;
+        this->albedo = .5f;
+    }
 
-        wi = z*r + rxy*cos(phi)*b1 + rxy*sin(phi)*b2;
-        brdf_val = eval(nrm, wo, wi);
+    [[nodiscard]] Material material() const override
+    {
+        Material m = BRDF::material();
+        m.type = Material::Type::Glossy;
+        m.power = power;
+        return m;
     }
 
 private:
@@ -166,38 +259,28 @@ public:
         glossy.power = 5;
     }
 
-    [[nodiscard]] float eval(
-            const Eigen::Vector3f &nrm,
-            const Eigen::Vector3f &wo,
-            const Eigen::Vector3f &wi
-    ) const override {
-        float kd_ = math::clip(kd, 0.f, 1.f);
-        return albedo * (kd_ * diffuse.eval(nrm, wo, wi) + (1.f-kd_) * glossy.eval(nrm, wo, wi));
-    }
-
-    [[nodiscard]] float pdf(
-            const Eigen::Vector3f &nrm,
-            const Eigen::Vector3f &wo,
-            const Eigen::Vector3f &wi
-    ) const override {
-        float kd_ = math::clip(kd, 0.f, 1.f);
-        return kd_ * diffuse.pdf(nrm, wo, wi) + (1.f-kd_) * glossy.pdf(nrm, wo, wi);
-    }
-
-    void sample_dir(
-            const Eigen::Vector3f &nrm,
-            const Eigen::Vector3f &wo,
-            Eigen::Vector3f &wi,
-            float &brdf_val,
-            UniformSampler<float> &sampler
-    ) const override {
-        float kd_ = math::clip(kd, 0.f, 1.f);
-        if (sampler.sample() < kd_) { diffuse.sample_dir(nrm, wo, wi, brdf_val, sampler); }
-        else { glossy.sample_dir(nrm, wo, wi, brdf_val, sampler); }
-        brdf_val = eval(nrm, wo, wi);
+    [[nodiscard]] Material material() const override
+    {
+        Material m;
+        m.type = Material::Type::Phong;
+        m.reflect_line = reflect_line;
+        m.albedo = albedo;
+        m.power = glossy.power;
+        m.kd = kd;
+        m.albedo_d = diffuse.albedo;
+        m.albedo_g = glossy.albedo;
+        return m;
     }
 
 private:
 };
 
-} // namespace rtnpr
\ No newline at end of file
+// the materials of the BRDFs, indexed by the mat_id of the hits
+inline void flatten_brdf(const std::vector<std::shared_ptr<BRDF>> &brdf, std::vector<Material> &materials)
+{
+    materials.clear();
+    materials.reserve(brdf.size());
+    for (const auto &b: brdf) { materials.push_back(b->material()); }
+}
+
+} // namespace rtnpr
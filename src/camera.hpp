@@ -28,6 +28,15 @@ public:
         radius = math::max(.01f, radius+disp);
     }
 
+    // places the camera on the sphere around the target, z being the height
+    // of the view direction on the unit sphere
+    void set_orbit(float _radius, float _phi, float _z)
+    {
+        radius = math::max(.01f, _radius);
+        phi = _phi;
+        z = math::clip(_z,-.99f,.99f);
+    }
+
     [[nodiscard]] Ray spawn_ray(float w, float h) const
     {
         using namespace Eigen;
@@ -47,6 +56,30 @@ public:
         return {eye, dir};
     }
 
+    // Inverse of spawn_ray: the screen coordinates (w,h) of the point p.
+    // Returns false for points behind the camera.
+    bool project(const Eigen::Vector3f &p, float &w, float &h) const
+    {
+        using namespace Eigen;
+        const Vector3f eye = pos();
+        const Vector3f to = (m_tar - eye).normalized();
+        const Vector3f right = to.cross(m_up).normalized();
+        const Vector3f up = right.cross(to).normalized();
+
+        const Vector3f d = p - eye;
+        const float depth = d.dot(to);
+        if (depth <= 0.f) { return false; }
+
+        const float c = std::cos(.5f*fov_rad);
+        w = .5f * (c * d.dot(right) / depth + 1.f);
+        h = .5f * (c * d.dot(up) / depth + 1.f);
+        return true;
+    }
+
+    [[nodiscard]] Eigen::Vector3f position() const { return pos(); }
+
+    bool operator==(const Camera &) const = default;
+
 private:
     float radius = 5.f;
     float phi = float(M_PI)*1.5f;
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "options.hpp"
+#include "stats.hpp"
+
+namespace rtnpr {
+
+// Picks the resolution and the samples per frame of the viewer from the cost
+// of the previous frames, so that a frame takes about opts.view.target_ms.
+// While the camera moves, frames take one sample per pixel at a resolution
+// scaled down as needed; once it stops, they go back to full resolution with
+// as many samples as fit, up to opts.rt.spp_frame.
+class FrameBudget {
+public:
+    // the scale goes in steps so that small changes of the frame time do not
+    // resize the accumulation on every frame
+    static constexpr int scale_steps = 16;
+
+    // resolution scale and samples per frame of the next frame
+    [[nodiscard]] float scale() const { return float(m_steps) / float(scale_steps); }
+    [[nodiscard]] int spp_frame() const { return m_spp_frame; }
+
+    // Called before each frame with the stats of the last one, which was
+    // rendered at scale() with spp_frame() on a full-size image of num_pixels.
+    void update(const stats::FrameStats &last, unsigned int num_pixels, bool moving, const Options &opts)
+    {
+        const auto &view = opts.view;
+        const int max_spp = std::max(opts.rt.spp_frame, 1);
+        if (!view.budget) {
+            m_steps = scale_steps;
+            m_spp_frame = max_spp;
+            return;
+        }
+
+        // milliseconds per sample, averaged over a few frames
+        const uint64_t samples_taken = last.counters[stats::Samples];
+        if (samples_taken > 0 && last.frame_ms > 0.) {
+            const double ms = last.frame_ms / double(samples_taken);
+            m_ms_per_sample = m_ms_per_sample > 0. ? .5 * (m_ms_per_sample + ms) : ms;
+        }
+        if (m_ms_per_sample <= 0.) { return; }
+        const double samples = double(view.target_ms) / m_ms_per_sample;
+        // Samples taken per unit of spp_frame at full resolution. The adaptive
+        // sampling boosts the pixels left and skips the converged ones, so it
+        // is measured on the last frame when that one was at full resolution.
+        double samples_per_spp = double(num_pixels);
+        if (samples_taken > 0 && m_steps == scale_steps) {
+            samples_per_spp = double(samples_taken) / double(m_spp_frame);
+        }
+
+        if (moving) {
+            m_spp_frame = 1;
+            const double s = std::sqrt(samples / double(num_pixels));
+            const int min_steps = std::max(1, int(std::ceil(view.min_scale * float(scale_steps))));
+            const int steps = std::clamp(int(s * scale_steps), min_steps, scale_steps);
+            // drops at once when over the budget, goes up with some margin
+            if (steps < m_steps || steps > m_steps + 1) { m_steps = steps; }
+        }
+        else {
+            m_steps = scale_steps;
+            m_spp_frame = std::clamp(int(samples / samples_per_spp), 1, max_spp);
+        }
+    }
+
+private:
+    int m_steps = scale_steps;
+    int m_spp_frame = 1;
+    double m_ms_per_sample = 0.;
+};
+
+} // namespace rtnpr
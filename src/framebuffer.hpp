@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+namespace rtnpr {
+
+// Accumulation buffer made of tile_size x tile_size tiles. All the state of
+// the pixels of a tile sits in one contiguous block, and the tiles are stored
+// in Morton order so that tiles dispatched next to each other also cover
+// neighbouring parts of the image.
+class FrameBuffer {
+public:
+    static constexpr unsigned int tile_size = 16;
+
+    struct alignas(64) Tile {
+        static constexpr unsigned int npix = tile_size * tile_size;
+
+        float L[3][npix];
+        float alpha_obj[npix];
+        float alpha_line[npix];
+        unsigned int spp[npix];
+        // sums of squared deviations of the luminance and of the line
+        // coverage of the samples, for adaptive sampling
+        float m2_lum[npix];
+        float m2_line[npix];
+        // what the first sample of the last frame hit, for the reprojection
+        // of the accumulation when the camera moves
+        float depth[npix];
+        int obj_id[npix];
+        int prim_id[npix];
+        // samples in a row that found no line, for the adaptive stencil
+        unsigned int quiet[npix];
+
+        void clear()
+        {
+            std::fill_n(&L[0][0], 3*npix, 0.f);
+            std::fill_n(alpha_obj, npix, 0.f);
+            std::fill_n(alpha_line, npix, 0.f);
+            std::fill_n(spp, npix, 0u);
+            std::fill_n(m2_lum, npix, 0.f);
+            std::fill_n(m2_line, npix, 0.f);
+            std::fill_n(depth, npix, std::numeric_limits<float>::max());
+            std::fill_n(obj_id, npix, -1);
+            std::fill_n(prim_id, npix, 0);
+            std::fill_n(quiet, npix, 0u);
+        }
+    };
+
+    void resize(unsigned int width, unsigned int height)
+    {
+        if (width == m_width && height == m_height) { return; }
+        m_width = width;
+        m_height = height;
+        m_ntile_w = (width+tile_size-1) / tile_size;
+        m_ntile_h = (height+tile_size-1) / tile_size;
+
+        const unsigned int ntiles = m_ntile_w * m_ntile_h;
+        std::vector<uint32_t> code(ntiles);
+        for (unsigned int ii = 0; ii < ntiles; ++ii) { code[ii] = morton(ii % m_ntile_w, ii / m_ntile_w); }
+        std::vector<unsigned int> order(ntiles);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return code[a] < code[b]; });
+
+        m_tile_w0.resize(ntiles);
+        m_tile_h0.resize(ntiles);
+        m_tile_ids.resize(ntiles);
+        for (unsigned int ii = 0; ii < ntiles; ++ii) {
+            m_tile_w0[ii] = (order[ii] % m_ntile_w) * tile_size;
+            m_tile_h0[ii] = (order[ii] / m_ntile_w) * tile_size;
+            m_tile_ids[order[ii]] = ii;
+        }
+
+        m_tiles.clear();
+        m_tiles.resize(ntiles);
+        clear();
+    }
+
+    void clear()
+    {
+        for (auto &tile: m_tiles) { tile.clear(); }
+    }
+
+    [[nodiscard]] unsigned int width() const { return m_width; }
+    [[nodiscard]] unsigned int height() const { return m_height; }
+    [[nodiscard]] unsigned int num_tiles() const { return m_tiles.size(); }
+
+    // tiles are indexed in Morton order
+    Tile &tile(unsigned int tile_id) { return m_tiles[tile_id]; }
+    [[nodiscard]] const Tile &tile(unsigned int tile_id) const { return m_tiles[tile_id]; }
+
+    // pixel range [iw0,iw1) x [ih0,ih1) covered by a tile
+    void tile_bounds(
+            unsigned int tile_id,
+            unsigned int &iw0, unsigned int &ih0,
+            unsigned int &iw1, unsigned int &ih1
+    ) const {
+        iw0 = m_tile_w0[tile_id];
+        ih0 = m_tile_h0[tile_id];
+        iw1 = std::min(iw0+tile_size, m_width);
+        ih1 = std::min(ih0+tile_size, m_height);
+    }
+
+    // tile covering the pixel (iw,ih)
+    [[nodiscard]] unsigned int tile_id(unsigned int iw, unsigned int ih) const
+    {
+        return m_tile_ids[(ih / tile_size) * m_ntile_w + iw / tile_size];
+    }
+
+    static unsigned int local_id(unsigned int iw, unsigned int ih)
+    {
+        return (ih % tile_size) * tile_size + (iw % tile_size);
+    }
+
+private:
+    unsigned int m_width = 0;
+    unsigned int m_height = 0;
+    unsigned int m_ntile_w = 0;
+    unsigned int m_ntile_h = 0;
+
+    std::vector<Tile> m_tiles;
+    std::vector<unsigned int> m_tile_w0;
+    std::vector<unsigned int> m_tile_h0;
+    // Morton index of the tiles in row-major order
+    std::vector<unsigned int> m_tile_ids;
+
+    static uint32_t morton(uint32_t x, uint32_t y)
+    {
+        auto spread = [](uint32_t v) {
+            v &= 0x0000ffffu;
+            v = (v | (v << 8)) & 0x00ff00ffu;
+            v = (v | (v << 4)) & 0x0f0f0f0fu;
+            v = (v | (v << 2)) & 0x33333333u;
+            v = (v | (v << 1)) & 0x55555555u;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+};
+
+} // namespace rtnpr
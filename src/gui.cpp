@@ -5,6 +5,7 @@
 #include "imgui_impl_opengl3.h"
 
 #define NEEDS_UPDATE(x) if (x) { opts.needs_update = true; }
+#define NEEDS_RESOLVE(x) if (x) { opts.needs_resolve = true; }
 
 namespace rtnpr {
 
@@ -24,13 +25,14 @@ Gui::~Gui()
     ImGui::DestroyContext();
 }
 
-void Gui::draw()
+void Gui::draw(const stats::FrameStats &stats)
 {
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
     opts.needs_update = false;
+    opts.needs_resolve = false;
 
     // GUI contents
     {
@@ -43,20 +45,34 @@ void Gui::draw()
             ImGui::SliderInt("spp", &opts.rt.spp_frame, 1, 64);
             ImGui::SliderInt("spp_max", &opts.rt.spp, 1, 1024);
             NEEDS_UPDATE(ImGui::SliderInt("depth", &opts.rt.depth, 1, 8))
+            // the variance of the samples taken before is not known
+            NEEDS_UPDATE(ImGui::Checkbox("adaptive", &opts.rt.adaptive))
+            ImGui::SliderFloat("target_error", &opts.rt.target_error, .001f, .1f, "%.3f", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderInt("min_spp", &opts.rt.min_spp, 2, 64);
+            ImGui::Checkbox("temporal", &opts.rt.temporal);
+            static int sampler = int(opts.rt.sampler);
+            if (ImGui::SliderInt("sampler", &sampler, 0, 2)) {
+                opts.rt.sampler = SamplerType(sampler);
+                opts.needs_update = true;
+            }
             static float back_brightness = 1.f;
-            ImGui::SliderFloat("back_brightness", &back_brightness, 0.f, 1.f);
+            NEEDS_RESOLVE(ImGui::SliderFloat("back_brightness", &back_brightness, 0.f, 1.f))
             opts.rt.back_color = Eigen::Vector3f{1.f,1.f,1.f} * back_brightness;
             ImGui::TreePop();
         }
 
         ImGui::SetNextItemOpen(true, ImGuiCond_Once);
         if (ImGui::TreeNode("flr")) {
-            ImGui::Checkbox("line_only", &opts.flr.line_only);
-            NEEDS_UPDATE(ImGui::SliderInt("n_aux", &opts.flr.n_aux, 4, 16))
+            // the radiance is not accumulated in line_only
+            NEEDS_UPDATE(ImGui::Checkbox("line_only", &opts.flr.line_only))
+            NEEDS_UPDATE(ImGui::SliderInt("n_aux", &opts.flr.n_aux, 4, SampleBlock::max_aux))
+            NEEDS_UPDATE(ImGui::Checkbox("share_stencil", &opts.flr.share_stencil))
+            NEEDS_UPDATE(ImGui::Checkbox("adaptive_stencil", &opts.flr.adaptive_stencil))
             NEEDS_UPDATE(ImGui::Checkbox("normal", &opts.flr.normal))
             NEEDS_UPDATE(ImGui::Checkbox("positions", &opts.flr.position))
             NEEDS_UPDATE(ImGui::Checkbox("wireframe", &opts.flr.wireframe))
             NEEDS_UPDATE(ImGui::SliderFloat("width", &opts.flr.linewidth, .5f, 5.f))
+            NEEDS_RESOLVE(ImGui::ColorEdit3("color", opts.flr.line_color.data()))
             ImGui::TreePop();
         }
 
@@ -74,10 +90,10 @@ void Gui::draw()
             static int map_mode = 1;
             if (ImGui::SliderInt("map_mode", &map_mode, 0, 2)) {
                 opts.tone.map_mode = ToneMapper::MapMode(map_mode);
-                opts.needs_update = true;
+                opts.needs_resolve = true;
             }
-            NEEDS_UPDATE(ImGui::Checkbox("map_lines", &opts.tone.map_lines))
-            ImGui::Checkbox("map_shading", &opts.tone.map_shading);
+            NEEDS_RESOLVE(ImGui::Checkbox("map_lines", &opts.tone.map_lines))
+            NEEDS_RESOLVE(ImGui::Checkbox("map_shading", &opts.tone.map_shading))
             {
                 using namespace Eigen;
                 if (opts.tone.map_shading) {
@@ -92,6 +108,29 @@ void Gui::draw()
             ImGui::TreePop();
         }
 
+        if (ImGui::TreeNode("view")) {
+            ImGui::Checkbox("budget", &opts.view.budget);
+            ImGui::SliderFloat("target_ms", &opts.view.target_ms, 8.f, 100.f);
+            ImGui::SliderFloat("min_scale", &opts.view.min_scale, .1f, 1.f);
+            ImGui::TreePop();
+        }
+
+        if (ImGui::TreeNode("stats")) {
+            ImGui::Text("%.2f ms/step, %u threads, %u spp", stats.frame_ms, stats.num_threads, stats.spp);
+            ImGui::Text("%.2f Mrays/s", stats.mrays_per_s());
+            for (int c = 0; c < stats::num_counters; ++c) {
+                ImGui::Text("%-15s %12llu", stats::counter_names[c], (unsigned long long) stats.counters[c]);
+            }
+            double total_ms = 0.;
+            for (double ms: stats.stage_ms) { total_ms += ms; }
+            for (int s = 0; s < stats::num_stages; ++s) {
+                const double share = total_ms > 0. ? 100. * stats.stage_ms[s] / total_ms : 0.;
+                ImGui::Text("%-15s %8.2f ms %5.1f%%", stats::stage_names[s], stats.stage_ms[s], share);
+            }
+            ImGui::Checkbox("record trace", &trace);
+            ImGui::TreePop();
+        }
+
         ImGui::End();
     }
 
@@ -3,6 +3,7 @@
 #include "GLFW/glfw3.h"
 
 #include "options.hpp"
+#include "stats.hpp"
 
 namespace rtnpr {
 
@@ -10,10 +11,13 @@ class Gui {
 public:
     Options opts;
 
+    // the frames are recorded as a Chrome trace while this is set
+    bool trace = false;
+
     explicit Gui(GLFWwindow *window);
     ~Gui();
 
-    void draw();
+    void draw(const stats::FrameStats &stats);
 
 private:
 
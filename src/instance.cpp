@@ -0,0 +1,47 @@
+#include "instance.h"
+
+namespace rtnpr {
+
+Instance::Instance(std::shared_ptr<const TriMesh> mesh)
+        : m_mesh(std::move(mesh))
+{
+    apply_transform();
+}
+
+Instance::~Instance() = default;
+
+void Instance::ray_cast(const Ray &ray, Hit &hit) const
+{
+    if (!this->visible) { return; }
+    m_mesh->ray_cast(ray, hit, m_xform, this->obj_id, this->mat_id);
+}
+
+void Instance::ray_cast_packet(const Ray *rays, Hit *hits, int n) const
+{
+    if (!this->visible) { return; }
+    m_mesh->ray_cast_packet(rays, hits, n, m_xform, this->obj_id, this->mat_id);
+}
+
+bool Instance::occluded(const Ray &ray) const
+{
+    if (!this->visible) { return false; }
+    return m_mesh->occluded(ray, m_xform);
+}
+
+void Instance::apply_transform()
+{
+    m_placement = Similarity(*this->transform);
+    m_xform = m_placement * m_mesh->similarity();
+    m_mesh_generation = m_mesh->generation();
+    touch();
+}
+
+// the generation already counts the edits of the mesh, no need to touch()
+void Instance::refresh()
+{
+    if (m_mesh->generation() == m_mesh_generation) { return; }
+    m_xform = m_placement * m_mesh->similarity();
+    m_mesh_generation = m_mesh->generation();
+}
+
+} // namespace rtnpr
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+
+#include "object.hpp"
+#include "trimesh.h"
+
+namespace rtnpr {
+
+// Copy of a mesh placed with its own transform. All the instances of a mesh
+// share its BVH: rays are moved into the frame of the mesh instead of the
+// mesh being rebuilt. The transform of an instance applies on top of the
+// placement of the mesh, which is typically left at the identity and hidden.
+class Instance: public Object {
+public:
+    static std::shared_ptr<Instance> create(std::shared_ptr<const TriMesh> mesh)
+    {
+        return std::make_shared<Instance>(std::move(mesh));
+    }
+
+    explicit Instance(std::shared_ptr<const TriMesh> mesh);
+    ~Instance();
+
+    void ray_cast(const Ray &ray, Hit &hit) const override;
+    void ray_cast_packet(const Ray *rays, Hit *hits, int n) const override;
+    [[nodiscard]] bool occluded(const Ray &ray) const override;
+    void apply_transform() override;
+    [[nodiscard]] Eigen::AlignedBox3f bounds() const override { return m_placement.to_world(m_mesh->bounds()); }
+
+    // follows the edits of the mesh, update_vertices and apply_transform
+    void refresh() override;
+    [[nodiscard]] uint64_t generation() const override { return Object::generation() + m_mesh->generation(); }
+
+    [[nodiscard]] const std::shared_ptr<const TriMesh> &mesh() const { return m_mesh; }
+
+private:
+    std::shared_ptr<const TriMesh> m_mesh;
+    Similarity m_placement;
+
+    // reference vertices of the mesh to world, as of m_mesh_generation
+    Similarity m_xform;
+    uint64_t m_mesh_generation = 0;
+};
+
+} // namespace rtnpr
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cmath>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "rtnpr_math.hpp"
@@ -7,48 +10,93 @@
 #include "options.hpp"
 #include "sampler.hpp"
 #include "ray.hpp"
-#include "scene.hpp"
+#include "scene.h"
+#include "stats.hpp"
+#include "stencil_cache.hpp"
 
 namespace rtnpr {
 namespace {
 
-bool test_feature_line(
-        const std::vector<Hit> &stencil,
-        const Options &opts
+// The feature lines tested besides the object boundaries. The stencil
+// kernels take the set as a template argument, so that the tests that are
+// off are compiled out of the loops over the rays.
+enum LineTest : unsigned int {
+    NormalTest = 1u << 0,
+    PositionTest = 1u << 1,
+    WireframeTest = 1u << 2,
+    num_line_test_sets = 1u << 3
+};
+
+inline unsigned int line_tests(const Options &opts)
+{
+    unsigned int tests = 0;
+    if (opts.flr.normal) { tests |= NormalTest; }
+    if (opts.flr.position) { tests |= PositionTest; }
+    if (opts.flr.wireframe) { tests |= WireframeTest; }
+    return tests;
+}
+
+// Calls f(std::integral_constant<unsigned int, tests>()), which instantiates
+// f for each of the sets.
+template<typename F, unsigned int... Sets>
+void dispatch_line_tests(unsigned int tests, F &&f, std::integer_sequence<unsigned int, Sets...>)
+{
+    (void) ((tests == Sets ? (f(std::integral_constant<unsigned int, Sets>()), true) : false) || ...);
+}
+
+template<typename F>
+void dispatch_line_tests(unsigned int tests, F &&f)
+{
+    dispatch_line_tests(tests, std::forward<F>(f), std::make_integer_sequence<unsigned int, num_line_test_sets>());
+}
+
+// cosine of the angle between the normals, .2 pi, beyond which there is a crease
+inline const float crease_cos = float(std::cos(.2*M_PI));
+
+// whether a feature line passes between the hits of the center and of an auxiliary ray
+template<unsigned int Tests>
+bool separated(
+        const Hit &cen_hit,
+        const Hit &aux_hit
 ) {
-    if (stencil.empty()) { return false; }
-    const auto &cen_hit = stencil[0];
-    for (int ii = 1; ii < stencil.size(); ++ii)
-    {
-        const auto &aux_hit = stencil[ii];
-        if (cen_hit.obj_id != aux_hit.obj_id) { return true; }
+    if (cen_hit.obj_id != aux_hit.obj_id) { return true; }
 
-        if (opts.flr.normal) {
-            const auto &n0 = cen_hit.nrm;
-            const auto &n1 = aux_hit.nrm;
-            if (std::acos(n0.dot(n1)) > .2*M_PI) { return true; }
-        }
+    if constexpr ((Tests & NormalTest) != 0) {
+        const auto &n0 = cen_hit.nrm;
+        const auto &n1 = aux_hit.nrm;
+        if (n0.dot(n1) < crease_cos) { return true; }
+    }
 
-        if (opts.flr.position) {
-            const auto &p0 = cen_hit.pos;
-            const auto &p1 = aux_hit.pos;
-            if ((p0-p1).norm() > 1e-1f) { return true; }
-        }
+    if constexpr ((Tests & PositionTest) != 0) {
+        const auto &p0 = cen_hit.pos;
+        const auto &p1 = aux_hit.pos;
+        if ((p0-p1).squaredNorm() > 1e-2f) { return true; }
+    }
 
-        if (opts.flr.wireframe) {
-            if (cen_hit.prim_id != aux_hit.prim_id) { return true; }
-        }
+    if constexpr ((Tests & WireframeTest) != 0) {
+        if (cen_hit.prim_id != aux_hit.prim_id) { return true; }
+    }
+    return false;
+}
+
+template<unsigned int Tests>
+bool test_feature_line(const std::vector<Hit> &stencil)
+{
+    if (stencil.empty()) { return false; }
+    for (int ii = 1; ii < stencil.size(); ++ii)
+    {
+        if (separated<Tests>(stencil[0], stencil[ii])) { return true; }
     }
     return false;
 }
 
 bool all_reflected(
         const std::vector<Hit> &stencil,
-        const Options &opts
+        const std::vector<Material> &materials
 ) {
     for (const auto &hit: stencil) {
         if (hit.obj_id < 0) { return false; }
-        if (!opts.scene.brdf[hit.mat_id]->reflect_line) { return false; }
+        if (!materials[hit.mat_id].reflect_line) { return false; }
     }
     return true;
 }
@@ -68,51 +116,111 @@ void nearest_hit(
     }
 }
 
-float stencil_test(
+// Rays of the stencil traced together before the stencil is tested. Most
+// pixels are off the lines and trace the whole stencil anyway, so the group
+// is the widest packet of TriMesh::ray_cast_packet: the stencils of up to 15
+// auxiliary rays go in a single packet.
+inline constexpr int stencil_group = 16;
+
+// Traces the camera ray through the sample center, stencil[0], and the
+// auxiliary rays sampled in a disc around it, stencil[1..]. The rays go in
+// packets of stencil_group. Tracing can only stop early past the first
+// packet, for stencils of more than 15 auxiliary rays: once a packet has an
+// auxiliary hit separated from the center, the pixel is on a line whatever
+// the other rays hit, and the stencil is shrunk to the hits traced. Most of
+// the rays are saved by the coarse stencil of the pixels far from the lines
+// instead, see flr.adaptive_stencil.
+// With a cache, the auxiliary rays that fall in a cell traced before take the
+// hit found there, and only the others are traced.
+// Returns whether a feature line was found.
+template<unsigned int Tests>
+bool trace_stencil(
         const Camera &camera,
         float cen_w, float cen_h, float radius,
         const Scene &scene,
+        std::vector<Ray> &rays,
         std::vector<Hit> &stencil,
         UniformSampler<float> &sampler,
-        const Options &opts
+        StencilCache *cache = nullptr
 ) {
-    float weight = 1.f;
+    const int n = int(stencil.size());
+    rays.assign(n, camera.spawn_ray(cen_w, cen_h));
+    if (cache) { cache->queue(cen_w, cen_h); }
+
+    sampler.start_block(SampleBlock::stencil);
+    int n_traced = 0;
+    int n_cached = 0;
+    bool line = false;
+    int g0 = 0;
+    while (g0 < n && !line) {
+        const int g1 = std::min(g0 + stencil_group, n);
+        // in a group, the traced rays fill the stencil from the front and
+        // the cached hits from the back
+        int n_ray = g0 == 0 ? 1 : 0;
+        int back = g1;
+        for (int ii = std::max(g0, 1); ii < g1; ++ii) {
+            auto [d_w, d_h] = sample_disc(sampler);
+            d_w *= radius;
+            d_h *= radius;
+            if (cache) {
+                if (const Hit *hit = cache->lookup(cen_w+d_w, cen_h+d_h)) {
+                    stencil[--back] = *hit;
+                    continue;
+                }
+            }
+            rays[g0+n_ray++] = camera.spawn_ray(cen_w+d_w, cen_h+d_h);
+        }
+        scene.ray_cast_packet(rays.data()+g0, stencil.data()+g0, n_ray);
+        if (cache) { cache->insert(stencil.data()+g0); }
+        n_traced += n_ray;
+        n_cached += g1 - back;
 
-    for (int ii = 1; ii < stencil.size(); ++ii) {
-        auto [d_w, d_h] = sample_disc(sampler);
-        d_w *= radius;
-        d_h *= radius;
-        auto ray = camera.spawn_ray(cen_w+d_w, cen_h+d_h);
-        scene.ray_cast(ray, stencil[ii]);
+        for (int ii = std::max(g0, 1); ii < g1 && !line; ++ii) { line = separated<Tests>(stencil[0], stencil[ii]); }
+        g0 = g1;
     }
+    stencil.erase(stencil.begin()+g0, stencil.end());
+    rays.erase(rays.begin()+g0, rays.end());
+
+    stats::add(stats::PrimaryRays);
+    stats::add(stats::StencilRays, n_traced-1);
+    stats::add(stats::SharedStencilRays, n_cached);
+    return line;
+}
 
-    if (test_feature_line(stencil, opts)) { return weight; }
-    if (!all_reflected(stencil, opts)) { return 0.f; }
+template<unsigned int Tests>
+float stencil_test(
+        const Scene &scene,
+        std::vector<Hit> &stencil,
+        std::vector<Ray> &rays,
+        UniformSampler<float> &sampler,
+        const std::vector<Material> &materials
+) {
+    float weight = 1.f;
+
+    if (test_feature_line<Tests>(stencil)) { return weight; }
+    if (!all_reflected(stencil, materials)) { return 0.f; }
 
-    const auto &brdf = opts.scene.brdf;
     Eigen::Vector3f org, wi;
     float brdf_val, pdf;
 
     {
         auto &hit = stencil[0];
-        brdf[hit.mat_id]->sample_dir(hit.nrm, hit.wo, wi, brdf_val, sampler);
-        pdf = brdf[hit.mat_id]->pdf(hit.nrm, hit.wo, wi);
+        sampler.start_block(SampleBlock::reflect);
+        materials[hit.mat_id].sample(hit.nrm, hit.wo, wi, brdf_val, pdf, sampler);
         org = hit.pos - hit.dist * wi;
-        Ray ray{hit.pos,wi};
-        Hit _hit;
-        scene.ray_cast(ray,_hit);
-        hit = _hit;
+        rays[0] = Ray{hit.pos,wi};
     }
 
     for (int ii=1; ii < stencil.size(); ++ii) {
-        auto &hit = stencil[ii];
-        Ray ray{hit.pos,(hit.pos-org).normalized()};
-        Hit _hit;
-        scene.ray_cast(ray,_hit);
-        hit = _hit;
+        const auto &hit = stencil[ii];
+        rays[ii] = Ray{hit.pos,(hit.pos-org).normalized()};
     }
 
-    if (test_feature_line(stencil, opts)) {
+    for (auto &hit: stencil) { hit = Hit(); }
+    scene.ray_cast_packet(rays.data(), stencil.data(), int(stencil.size()));
+    stats::add(stats::ReflectRays, stencil.size());
+
+    if (test_feature_line<Tests>(stencil)) {
         int id;
         nearest_hit(stencil, id);
         if (brdf_val <= 0 || id < 0) { return 0.f; }
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 
+#include <Eigen/Geometry>
+
 #include "ray.hpp"
 #include "hit.hpp"
 #include "transform.hpp"
@@ -18,7 +21,42 @@ public:
     std::shared_ptr<Transform> transform = std::make_shared<Transform>();
 
     virtual void ray_cast(const Ray &ray, Hit &hit) const = 0;
+
+    // Casts a packet of n rays, updating hits[ii] as ray_cast(rays[ii],hits[ii]) would.
+    virtual void ray_cast_packet(const Ray *rays, Hit *hits, int n) const
+    {
+        for (int ii = 0; ii < n; ++ii) { ray_cast(rays[ii], hits[ii]); }
+    }
+
+    // Whether anything of the object lies along the ray within [tmin,tmax].
+    // Cheaper than ray_cast for shadow rays since any hit will do.
+    [[nodiscard]] virtual bool occluded(const Ray &ray) const
+    {
+        Hit hit;
+        ray_cast(ray, hit);
+        return hit.obj_id >= 0;
+    }
+
+    // Implementations call touch(), as does anything else that moves the
+    // geometry of the object.
     virtual void apply_transform() = 0;
+
+    // axis-aligned bounds in world space
+    [[nodiscard]] virtual Eigen::AlignedBox3f bounds() const = 0;
+
+    // Re-derives what the object caches from the objects it depends on.
+    // Scene::commit calls it before comparing the generations.
+    virtual void refresh() {}
+
+    // changes whenever the bounds may have, including through the objects
+    // this one depends on, so that a Scene can tell its top-level BVH is stale
+    [[nodiscard]] virtual uint64_t generation() const { return m_generation; }
+
+protected:
+    void touch() { ++m_generation; }
+
+private:
+    uint64_t m_generation = 0;
 };
 
 } // namespace rtnpr
@@ -10,15 +10,38 @@
 
 namespace rtnpr {
 
+// The fields fall into three groups:
+// - sampling and scene (rt.depth, rt.seed, rt.sampler, rt.adaptive, flr
+//   except line_color, scene) change what is accumulated,
+// - display (rt.back_color, flr.line_color, tone) only change how the
+//   accumulation is mapped to the image,
+// - the others (rt.spp_frame, rt.spp, rt.target_error, rt.min_spp,
+//   rt.temporal, view) only steer how many samples are taken and apply to
+//   the next frame.
 struct Options {
 public:
+    // the accumulated samples are invalid, rendering restarts
     bool needs_update = false;
+    // only the display changed, the accumulation is resolved to the image again
+    bool needs_resolve = false;
 
     struct {
         int spp_frame = 1;
         int spp = 128;
         int depth = 4;
+        uint32_t seed = 0;
+        SamplerType sampler = SamplerType::Sobol;
         Eigen::Vector3f back_color{1.f,1.f,1.f};
+        // With adaptive, a pixel stops being sampled after min_spp samples
+        // once the standard error of its luminance, relative to the mean, and
+        // of its line coverage fall below target_error. The samples saved go
+        // to the pixels that have not converged.
+        bool adaptive = false;
+        float target_error = .02f;
+        int min_spp = 16;
+        // When the camera moves, the pixels that still see the same surface
+        // start from the accumulation of the previous view instead of zero.
+        bool temporal = false;
     } rt;
 
     struct {
@@ -27,7 +50,15 @@ public:
         bool position = false;
         bool wireframe = true;
         float linewidth = 1.f;
-        int n_aux = 4;
+        int n_aux = 4;  // 1 to SampleBlock::max_aux
+        // The auxiliary rays of neighbouring pixels share their hits, see
+        // StencilCache. Only the same sample of the pixels shares, so the
+        // samples of a pixel stay independent for rt.adaptive, and only the
+        // first StencilCache::max_layers samples of a frame do. The cache
+        // takes up to 4 x 256 x 256 hits, about 14 MB, per thread.
+        bool share_stencil = false;
+        // the pixels far from the lines test a few auxiliary rays only
+        bool adaptive_stencil = false;
         Eigen::Vector3f line_color{93.f/255.f, 63.f/255.f, 221.f/255.f};
     } flr;
 
@@ -54,6 +85,14 @@ public:
         bool map_shading = true;
     } tone;
 
+    // frame-time budget of the viewer, see FrameBudget
+    struct {
+        bool budget = false;
+        float target_ms = 33.f;
+        // lowest resolution, relative to the full one, while the camera moves
+        float min_scale = .25f;
+    } view;
+
 };
 
 } // namespace rtnpr
\ No newline at end of file
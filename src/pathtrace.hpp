@@ -6,8 +6,9 @@
 #include "rtnpr_math.hpp"
 #include "brdf.hpp"
 #include "light.hpp"
-#include "scene.hpp"
+#include "scene.h"
 #include "options.hpp"
+#include "stats.hpp"
 
 namespace rtnpr::kernel {
 namespace {
@@ -18,16 +19,16 @@ void ptrace(
         const Scene &scene,
         float weight,
         Eigen::Vector3f &L,
+        const std::vector<Material> &materials,
         const Options &opts,
         UniformSampler<float> &sampler
 ) {
     using namespace Eigen;
 
     if (first_hit.obj_id < 0) { return; }
-    if (opts.scene.brdf.empty()) { return; }
+    if (materials.empty()) { return; }
     if (opts.scene.light.empty()) { return; }
 
-    const auto &brdf = opts.scene.brdf;
     const auto &light = opts.scene.light[0];
 
     Vector3f pos, nrm, wo, wi;
@@ -38,15 +39,16 @@ void ptrace(
 
     for (int dd = 0; dd < opts.rt.depth-1; ++dd)
     {
-        assert(mat_id < brdf.size());
+        assert(mat_id < materials.size());
+        const auto &mat = materials[mat_id];
         float brdf_val;
         {
+            sampler.start_block(SampleBlock::bounce + 2*dd);
             light->sample_dir(wi, sampler);
-            Hit hit;
             Ray ray{pos,wi};
-            scene.ray_cast(ray,hit);
-            if (hit.obj_id < 0) {
-                brdf_val = brdf[mat_id]->eval(nrm, wo, wi);
+            stats::add(stats::ShadowRays);
+            if (!scene.occluded(ray)) {
+                brdf_val = mat.eval(nrm, wo, wi);
                 float pdf = light->pdf(wi);
                 if (brdf_val > 0) {
                     assert(pdf > 0);
@@ -58,8 +60,9 @@ void ptrace(
             }
         }
 
-        brdf[mat_id]->sample_dir(nrm, wo, wi, brdf_val, sampler);
-        float pdf = brdf[mat_id]->pdf(nrm, wo, wi);
+        sampler.start_block(SampleBlock::bounce + 2*dd + 1);
+        float pdf;
+        mat.sample(nrm, wo, wi, brdf_val, pdf, sampler);
         if (brdf_val <= 0) { return; }
         assert(pdf > 0);
         weight *= brdf_val / pdf;
@@ -67,6 +70,7 @@ void ptrace(
         Hit hit;
         Ray ray{pos,wi};
         scene.ray_cast(ray,hit);
+        stats::add(stats::BounceRays);
         if (hit.obj_id < 0) { return; }
 
         pos = hit.pos;
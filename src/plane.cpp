@@ -55,6 +55,19 @@ void Plane::apply_transform()
     m_b2 = rot * Vector3f::UnitY();
     m_width = this->transform->scale;
     m_height = this->transform->scale;
+    touch();
+}
+
+Eigen::AlignedBox3f Plane::bounds() const
+{
+    using namespace Eigen;
+    AlignedBox3f box;
+    for (float sw: {-.5f, .5f}) {
+        for (float sh: {-.5f, .5f}) {
+            box.extend(m_center + sw * m_width * m_b1 + sh * m_height * m_b2);
+        }
+    }
+    return box;
 }
 
 
@@ -26,6 +26,7 @@ public:
 
     void ray_cast(const Ray &ray, Hit &hit) const override;
     void apply_transform() override;
+    [[nodiscard]] Eigen::AlignedBox3f bounds() const override;
 
 private:
     Eigen::Vector3f m_center = Eigen::Vector3f::Zero();
@@ -8,6 +8,8 @@ namespace rtnpr {
 
 struct Ray{
 public:
+    Ray() = default;
+
     template<typename VEC3>
     Ray(const VEC3 &_org, const VEC3 &_dir)
     {
@@ -1,17 +1,11 @@
 #include "raytracer.h"
 
-#include <thread>
-
-#include "delfem2/thread.h"
-
 #include "rtnpr_math.hpp"
 #include "linetest.hpp"
 #include "brdf.hpp"
 #include "pathtrace.hpp"
 
 
-namespace dfm2 = delfem2;
-
 namespace rtnpr {
 
 void RayTracer::step(
@@ -23,105 +17,429 @@ void RayTracer::step(
     using namespace std;
     using namespace Eigen;
 
+    const auto frame_begin = stats::Clock::now();
+    const uint64_t ticks_begin = stats::ticks();
+
     img.resize(height*width*3);
-    if (m_img.size() != img.size()) {
-        m_img.resize(img.size());
-        reset();
+    // A move of the camera or a new size invalidates the accumulation, unless
+    // it is reprojected. The previous view keeps its own size, so the
+    // resolution steps of the viewer's frame budget reproject too.
+    const bool resized = m_fb.width() != width || m_fb.height() != height;
+    bool reproject = false;
+    if (resized || (m_camera && !(*m_camera == camera))) {
+        if (opts.rt.temporal && m_spp > 0) {
+            std::swap(m_fb, m_prev_fb);
+            m_fb.resize(width, height);
+            m_fb.clear();
+            m_prev_camera.emplace(*m_camera);
+            m_spp = 0;
+            m_boost = 1;
+            reproject = true;
+        }
+        else {
+            if (resized) { m_fb.resize(width, height); }
+            reset();
+        }
+        m_lines.assign(size_t(width)*height, 0);
     }
+    // read only during the frame, so that the pixels of a tile see the
+    // lines of the neighbouring tiles without racing with them
+    m_prev_lines = m_lines;
+    m_camera.emplace(camera);
+    scene.commit();
+    flatten_brdf(opts.scene.brdf, m_materials);
 
-    unsigned int nthreads = std::thread::hardware_concurrency();
-    std::vector<UniformSampler<float>> sampler_pool(nthreads);
+    const unsigned int nthreads = m_pool.size();
+    m_thread_stats.assign(nthreads, stats::ThreadStats());
     std::vector<std::vector<Hit>> stencil(nthreads);
-    auto func0 = [&](int ih, int iw, int tid) {
-        const int spp_frame = opts.rt.spp_frame;
-        if (spp_frame <= 0) { return; }
-        if (m_spp > opts.rt.spp) { return; }
+    std::vector<std::vector<Ray>> rays(nthreads);
+    const float stencil_radius = opts.flr.linewidth/800.f;
+    assert(opts.flr.n_aux >= 1 && opts.flr.n_aux <= SampleBlock::max_aux);
+    const bool share_stencil = opts.flr.share_stencil;
+    if (share_stencil) { m_stencil_cache.resize(nthreads); }
+    // pixels that have not converged get the samples saved on the others
+    const bool adaptive = opts.rt.adaptive;
+    const int spp_pixel = adaptive ? opts.rt.spp_frame * int(m_boost) : opts.rt.spp_frame;
+    // Whether a line was found last frame around the pixel (iw,ih), which then
+    // keeps the full stencil: the soft edges of a line are rarely found by
+    // the coarse one.
+    auto near_line = [&](int iw, int ih) {
+        for (int h = std::max(ih-1, 0); h <= std::min(ih+1, int(height)-1); ++h) {
+            for (int w = std::max(iw-1, 0); w <= std::min(iw+1, int(width)-1); ++w) {
+                if (m_prev_lines[size_t(h)*width + w]) { return true; }
+            }
+        }
+        return false;
+    };
+    // returns whether the pixel was sampled, tests is the set of line tests
+    // as an std::integral_constant
+    auto func0 = [&](auto tests, int ih, int iw, int tid, FrameBuffer::Tile &tile) {
+        constexpr unsigned int Tests = decltype(tests)::value;
+        if (opts.rt.spp_frame <= 0) { return false; }
+        if (m_spp > opts.rt.spp) { return false; }
 
+        const unsigned int loc_id = FrameBuffer::local_id(iw, ih);
+        const size_t pix_id = size_t(ih)*width + iw;
+        int spp_frame = spp_pixel;
+        if (adaptive) {
+            const int spp = int(tile.spp[loc_id]);
+            if (spp >= opts.rt.spp || converged(tile, loc_id, opts)) { return false; }
+            spp_frame = std::min(spp_frame, opts.rt.spp - spp);
+        }
+        stats::add(stats::SampledPixels);
+        stats::add(stats::Samples, spp_frame);
+
+        stats::StageTimer timer(m_thread_stats[tid]);
         Vector3f L{0.f,0.f,0.f};
         float alpha_obj = 0.f;
         float alpha_line = 0.f;
+        Moments lum, line;
+        bool found_line = false;
+        // reprojection changes tile.spp, the sample indices keep going from here
+        const unsigned int spp0 = tile.spp[loc_id];
 
         for (int ii = 0; ii < spp_frame; ++ii)
         {
+            UniformSampler<float> sampler(opts.rt.sampler, opts.rt.seed, iw, ih, spp0+ii);
+            sampler.start_block(SampleBlock::pixel);
             const auto [cen_w,cen_h] = sample_pixel(
                     (float(iw)+.5f)/float(width),
                     (float(ih)+.5f)/float(height),
                     1.2f/float(width), 1.2f/float(height),
-                    sampler_pool[tid]
+                    sampler
             );
 
             const float weight = 1.f / float(spp_frame);
 
+            // the pixels that showed no line for a while test a coarse stencil
+            int n_aux = opts.flr.n_aux;
+            if (opts.flr.adaptive_stencil && tile.quiet[loc_id] >= quiet_samples) {
+                if (near_line(iw, ih)) { tile.quiet[loc_id] = 0; }
+                else { n_aux = std::min(n_aux, coarse_aux); }
+            }
+
+            // the samples past the grids of the cache trace their stencils in full
+            StencilCache *cache = nullptr;
+            if (share_stencil && ii < StencilCache::max_layers) {
+                cache = &m_stencil_cache[tid];
+                cache->select(ii);
+            }
             auto &stncl = stencil[tid];
             stncl.clear();
-            stncl.resize(opts.flr.n_aux+1);
-            Hit hit;
-            Ray ray = camera.spawn_ray(cen_w, cen_h);
-            scene.ray_cast(ray, hit);
-
-            stncl[0] = hit;
-            float line_weight = stencil_test(
+            stncl.resize(n_aux+1);
+            trace_stencil<Tests>(
                     camera, cen_w, cen_h,
-                    opts.flr.linewidth/800.f,
-                    scene, stncl,
-                    sampler_pool[tid], opts
+                    stencil_radius,
+                    scene, rays[tid], stncl,
+                    sampler,
+                    cache
+            );
+            timer.lap(stats::CameraRays);
+
+            const Hit hit = stncl[0];
+            const Ray ray = rays[tid][0];
+            if (ii == 0) {
+                if (reproject) {
+                    const float jitter_w = cen_w - (float(iw)+.5f)/float(width);
+                    const float jitter_h = cen_h - (float(ih)+.5f)/float(height);
+                    reproject_pixel(tile, loc_id, hit, ray, jitter_w, jitter_h, opts);
+                }
+                tile.depth[loc_id] = hit.dist;
+                tile.obj_id[loc_id] = hit.obj_id;
+                tile.prim_id[loc_id] = hit.prim_id;
+            }
+            float line_weight = stencil_test<Tests>(
+                    scene, stncl, rays[tid],
+                    sampler, m_materials
             );
             line_weight = math::min(1.f, line_weight);
+            timer.lap(stats::StencilTest);
+            if (line_weight > 0.f) {
+                tile.quiet[loc_id] = 0;
+                found_line = true;
+            }
+            else if (tile.quiet[loc_id] < quiet_samples) { ++tile.quiet[loc_id]; }
 
             alpha_line += weight * line_weight;
+            if (hit.obj_id >= 0) { alpha_obj += weight * (1.f-line_weight); }
+
+            // the shading would be thrown away, only the coverage is accumulated
+            if (opts.flr.line_only) {
+                if (adaptive) { line.add(line_weight); }
+                continue;
+            }
 
+            const Vector3f L0 = L;
             if (hit.obj_id >= 0) {
                 kernel::ptrace(
                         ray, hit, scene,
                         weight, L,
-                        opts,
-                        sampler_pool[tid]
+                        m_materials, opts,
+                        sampler
                 );
                 assert(!std::isnan(L.squaredNorm()));
-                alpha_obj += weight * (1.f-line_weight);
+                timer.lap(stats::PathTrace);
+            }
+
+            if (adaptive) {
+                const Vector3f Ls = (L - L0) / weight;
+                lum.add(luminance(Ls[0], Ls[1], Ls[2]));
+                line.add(line_weight);
             }
         }
-        accumulate_and_write(img, ih*width+iw, L, alpha_obj, alpha_line, opts);
+        m_lines[pix_id] = found_line;
+        if (adaptive) { accumulate_moments(tile, loc_id, lum, line); }
+        accumulate(
+                tile, loc_id,
+                L, alpha_obj, alpha_line,
+                spp_frame, opts
+        );
+        timer.lap(stats::Resolve);
+        return true;
     };
-    delfem2::parallel_for(width, height, func0, nthreads);
 
-    m_spp += opts.rt.spp_frame;
+    // tiles are visited in Morton order, and each thread starts on a
+    // contiguous run of them; the kernels are picked for the line tests once
+    // for the frame
+    dispatch_line_tests(line_tests(opts), [&](auto tests) {
+        m_pool.run(m_fb.num_tiles(), [&](unsigned int tile_id, unsigned int tid) {
+            const auto tile_begin = m_trace.active() ? stats::Clock::now() : stats::Clock::time_point();
+            // the counters deep in the traversals find the stats of the thread through stats::local
+            stats::local = &m_thread_stats[tid];
+            unsigned int iw0, ih0, iw1, ih1;
+            m_fb.tile_bounds(tile_id, iw0, ih0, iw1, ih1);
+            auto &tile = m_fb.tile(tile_id);
+            if (share_stencil) {
+                // the stencils of the pixels on the border reach out of the tile
+                // by their radius and the jitter of the samples
+                const float apron_w = stencil_radius + .1f/float(width);
+                const float apron_h = stencil_radius + .1f/float(height);
+                const float cell = stencil_radius / stencil_cells_per_radius;
+                m_stencil_cache[tid].start(
+                        float(iw0)/float(width) - apron_w, float(ih0)/float(height) - apron_h,
+                        float(iw1)/float(width) + apron_w, float(ih1)/float(height) + apron_h,
+                        cell, cell, spp_pixel
+                );
+            }
+            bool sampled = false;
+            for (unsigned int ih = ih0; ih < ih1; ++ih) {
+                for (unsigned int iw = iw0; iw < iw1; ++iw) { sampled |= func0(tests, int(ih), int(iw), int(tid), tile); }
+            }
+            // tiles that are done keep their pixels, resolve() rewrites them for display changes
+            if (sampled) {
+                stats::StageTimer timer(m_thread_stats[tid]);
+                resolve_tile(img, width, tile, iw0, ih0, iw1, ih1, opts);
+                timer.lap(stats::Resolve);
+            }
+            stats::local = nullptr;
+            if (m_trace.active()) { m_trace.record(tid, "tile", tile_id, tile_begin, stats::Clock::now()); }
+        });
+    });
+
+    m_spp += spp_pixel;
+    // boosted frames overshoot, the pixels themselves stop at opts.rt.spp
+    if (adaptive) { m_spp = std::min(m_spp, unsigned(std::max(opts.rt.spp, 0))); }
+
+    const uint64_t ticks_end = stats::ticks();
+    const auto frame_end = stats::Clock::now();
+    m_trace.record(0, "frame", m_frame++, frame_begin, frame_end);
+
+    m_stats = stats::FrameStats();
+    m_stats.frame_ms = std::chrono::duration<double, std::milli>(frame_end - frame_begin).count();
+    const double ms_per_tick = ticks_end > ticks_begin ? m_stats.frame_ms / double(ticks_end - ticks_begin) : 0.;
+    for (const auto &ts: m_thread_stats) {
+        for (int c = 0; c < stats::num_counters; ++c) { m_stats.counters[c] += ts.counters[c]; }
+        for (int s = 0; s < stats::num_stages; ++s) { m_stats.stage_ms[s] += double(ts.stage_ticks[s]) * ms_per_tick; }
+    }
+    m_stats.num_threads = nthreads;
+    m_stats.spp = m_spp;
+
+    // spreads the work of the pixels that stopped over the next frames
+    const uint64_t sampled = m_stats.counters[stats::SampledPixels];
+    m_boost = 1;
+    if (adaptive && sampled > 0) {
+        m_boost = unsigned(std::clamp<uint64_t>(uint64_t(width)*height / sampled, 1, max_boost));
+    }
 }
 
-void RayTracer::accumulate_and_write(
-        std::vector<unsigned char> &img,
-        unsigned int pix_id,
-        Eigen::Vector3f &L,
+void RayTracer::accumulate(
+        FrameBuffer::Tile &tile,
+        unsigned int loc_id,
+        const Eigen::Vector3f &L,
         float alpha_obj, float alpha_line,
+        unsigned int num_samples,
         const Options &opts
 ) {
-    float t = float(m_spp) / float(m_spp + opts.rt.spp_frame);
-    m_alpha_obj[pix_id] = t * m_alpha_obj[pix_id] + (1.f-t) * alpha_obj;
-    m_alpha_line[pix_id] = t * m_alpha_line[pix_id] + (1.f-t) * alpha_line;
-    m_img[pix_id] = t * m_img[pix_id] + (1.f-t) * L;
+    auto &spp = tile.spp[loc_id];
+    float t = float(spp) / float(spp + num_samples);
+    spp += num_samples;
 
-    using namespace Eigen;
-    Vector3f c = Vector3f::Ones();
-    if (!opts.flr.line_only) { c = opts.tone.mapper.map3(m_img[pix_id], opts.tone.map_mode); }
-    c *= m_alpha_obj[pix_id];
-    if (opts.tone.map_lines) { c += m_alpha_line[pix_id] * opts.tone.mapper.map(5.f*m_alpha_line[pix_id]); }
-    else { c += m_alpha_line[pix_id] * opts.flr.line_color; }
-    c += opts.rt.back_color * math::max(0., 1.-m_alpha_obj[pix_id]-m_alpha_line[pix_id]);
-    img[pix_id*3+0] = math::to_u8(c[0]);
-    img[pix_id*3+1] = math::to_u8(c[1]);
-    img[pix_id*3+2] = math::to_u8(c[2]);
+    auto &a_obj = tile.alpha_obj[loc_id];
+    auto &a_line = tile.alpha_line[loc_id];
+    a_obj = t * a_obj + (1.f-t) * alpha_obj;
+    a_line = t * a_line + (1.f-t) * alpha_line;
+    if (!opts.flr.line_only) {
+        for (int ii = 0; ii < 3; ++ii) { tile.L[ii][loc_id] = t * tile.L[ii][loc_id] + (1.f-t) * L[ii]; }
+    }
+}
+
+void RayTracer::accumulate_moments(
+        FrameBuffer::Tile &tile,
+        unsigned int loc_id,
+        const Moments &lum,
+        const Moments &line
+) {
+    const unsigned int n = tile.spp[loc_id];
+    const float mean_lum = luminance(tile.L[0][loc_id], tile.L[1][loc_id], tile.L[2][loc_id]);
+    tile.m2_lum[loc_id] = merge_m2(tile.m2_lum[loc_id], mean_lum, n, lum);
+    tile.m2_line[loc_id] = merge_m2(tile.m2_line[loc_id], tile.alpha_line[loc_id], n, line);
+}
+
+bool RayTracer::converged(
+        const FrameBuffer::Tile &tile,
+        unsigned int loc_id,
+        const Options &opts
+) {
+    const unsigned int n = tile.spp[loc_id];
+    if (n < unsigned(std::max(opts.rt.min_spp, 2))) { return false; }
+    // the error of the radiance is relative to its mean, with a floor so that
+    // dark pixels do not keep sampling noise that does not show
+    static constexpr float min_lum = .05f;
+    const float lum = luminance(tile.L[0][loc_id], tile.L[1][loc_id], tile.L[2][loc_id]);
+    const float err_lum = standard_error(tile.m2_lum[loc_id], n) / std::max(lum, min_lum);
+    const float err_line = standard_error(tile.m2_line[loc_id], n);
+    return std::max(err_lum, err_line) <= opts.rt.target_error;
+}
+
+bool RayTracer::reproject_pixel(
+        FrameBuffer::Tile &tile,
+        unsigned int loc_id,
+        const Hit &hit, const Ray &ray,
+        float jitter_w, float jitter_h,
+        const Options &opts
+) const {
+    const Camera &prev = *m_prev_camera;
+    // the background has no position, it is looked up by its direction
+    const Eigen::Vector3f p = hit.obj_id >= 0 ? hit.pos : Eigen::Vector3f(prev.position() + ray.dir);
+    float w, h;
+    if (!prev.project(p, w, h)) { return false; }
+    // the pixel center moves with the sample
+    w -= jitter_w;
+    h -= jitter_h;
+    if (w < 0.f || w >= 1.f || h < 0.f || h >= 1.f) { return false; }
+
+    const int width = int(m_prev_fb.width());
+    const int height = int(m_prev_fb.height());
+    const int iw = std::min(int(w * float(width)), width-1);
+    const int ih = std::min(int(h * float(height)), height-1);
+    const auto &src = m_prev_fb.tile(m_prev_fb.tile_id(iw, ih));
+    const unsigned int src_id = FrameBuffer::local_id(iw, ih);
+    // the first sample of the last frame of the pixel saw another surface
+    if (src.spp[src_id] == 0 || src.obj_id[src_id] != hit.obj_id) { return false; }
+    // the wireframe lines are drawn where the primitive changes
+    if (opts.flr.wireframe && src.prim_id[src_id] != hit.prim_id) { return false; }
+    if (hit.obj_id >= 0) {
+        // something else was in front in the previous view
+        const float depth = (hit.pos - prev.position()).norm();
+        if (std::abs(depth - src.depth[src_id]) > max_depth_error * depth) { return false; }
+    }
+    // the pixel is on a silhouette, whose coverage does not follow the surface
+    const float coverage = src.alpha_obj[src_id] + src.alpha_line[src_id];
+    if (std::abs(coverage - (hit.obj_id >= 0 ? 1.f : 0.f)) > max_coverage_error) { return false; }
+
+    const unsigned int n = src.spp[src_id];
+    const unsigned int n_hist = std::min(n, max_history);
+    const float scale = float(n_hist) / float(n);
+    for (int ch = 0; ch < 3; ++ch) { tile.L[ch][loc_id] = src.L[ch][src_id]; }
+    tile.alpha_obj[loc_id] = src.alpha_obj[src_id];
+    tile.alpha_line[loc_id] = src.alpha_line[src_id];
+    tile.spp[loc_id] = n_hist;
+    tile.m2_lum[loc_id] = scale * src.m2_lum[src_id];
+    tile.m2_line[loc_id] = scale * src.m2_line[src_id];
+    tile.quiet[loc_id] = src.quiet[src_id];
+    return true;
+}
+
+void RayTracer::resolve(std::vector<unsigned char> &img, const Options &opts)
+{
+    const unsigned int width = m_fb.width();
+    const unsigned int height = m_fb.height();
+    if (width == 0 || height == 0) { return; }
+    img.resize(height*width*3);
+
+    m_pool.run(m_fb.num_tiles(), [&](unsigned int tile_id, unsigned int) {
+        unsigned int iw0, ih0, iw1, ih1;
+        m_fb.tile_bounds(tile_id, iw0, ih0, iw1, ih1);
+        resolve_tile(img, width, m_fb.tile(tile_id), iw0, ih0, iw1, ih1, opts);
+    });
+}
+
+void RayTracer::resolve_tile(
+        std::vector<unsigned char> &img,
+        unsigned int width,
+        const FrameBuffer::Tile &tile,
+        unsigned int iw0, unsigned int ih0,
+        unsigned int iw1, unsigned int ih1,
+        const Options &opts
+) {
+    static constexpr unsigned int npix = FrameBuffer::Tile::npix;
+    const auto &mapper = opts.tone.mapper;
+
+    // tone mapping of the whole tile, one plane at a time
+    alignas(64) float c[3][npix];
+    float *const c_ptr[3] = {c[0], c[1], c[2]};
+    if (!opts.flr.line_only) {
+        const float *const L[3] = {tile.L[0], tile.L[1], tile.L[2]};
+        mapper.map3_batch(L, c_ptr, npix, opts.tone.map_mode);
+    }
+    else { std::fill_n(&c[0][0], 3*npix, 1.f); }
+
+    alignas(64) float line[3][npix];
+    if (opts.tone.map_lines) {
+        alignas(64) float x[npix];
+        for (unsigned int i = 0; i < npix; ++i) { x[i] = 5.f*tile.alpha_line[i]; }
+        float *const line_ptr[3] = {line[0], line[1], line[2]};
+        mapper.map_batch(x, line_ptr, npix);
+    }
+    else {
+        for (int ch = 0; ch < 3; ++ch) { std::fill_n(line[ch], npix, opts.flr.line_color[ch]); }
+    }
+
+    // blending and quantization run on planes so that they vectorize, the
+    // bytes are interleaved into the image at the end
+    alignas(64) uint8_t q[3][npix];
+    for (int ch = 0; ch < 3; ++ch) {
+        const float back = opts.rt.back_color[ch];
+        for (unsigned int i = 0; i < npix; ++i) {
+            const float a_obj = tile.alpha_obj[i];
+            const float a_line = tile.alpha_line[i];
+            float v = c[ch][i] * a_obj;
+            v += a_line * line[ch][i];
+            // max(0,w) without a branch, which would keep the loop scalar
+            const float w = 1.f-a_obj-a_line;
+            v += back * (.5f * (w + std::abs(w)));
+            c[ch][i] = v;
+        }
+        ToneMapper::quantize(c[ch], q[ch], npix);
+    }
+
+    for (unsigned int ih = ih0; ih < ih1; ++ih) {
+        unsigned char *row = img.data() + (size_t(ih)*width + iw0)*3;
+        const unsigned int loc0 = FrameBuffer::local_id(iw0, ih);
+        for (unsigned int k = 0; k < iw1-iw0; ++k) {
+            row[3*k+0] = q[0][loc0+k];
+            row[3*k+1] = q[1][loc0+k];
+            row[3*k+2] = q[2][loc0+k];
+        }
+    }
 }
 
 void RayTracer::reset()
 {
-    auto size = m_img.size();
-    m_img.clear();
-    m_img.resize(size,Eigen::Vector3f::Zero());
-    m_alpha_obj.clear();
-    m_alpha_obj.resize(size/3,0.);
-    m_alpha_line.clear();
-    m_alpha_line.resize(size/3,0.);
+    m_fb.clear();
+    std::fill(m_lines.begin(), m_lines.end(), 0);
     m_spp = 0;
+    m_boost = 1;
 }
 
 } // namespace rtnpr
\ No newline at end of file
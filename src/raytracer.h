@@ -1,12 +1,20 @@
 #pragma once
 
 #include <memory>
+#include <optional>
+#include <string>
 #include <vector>
 
 #include "options.hpp"
-#include "scene.hpp"
+#include "scene.h"
 #include "sampler.hpp"
 #include "camera.hpp"
+#include "framebuffer.hpp"
+#include "thread_pool.h"
+#include "stats.hpp"
+#include "stencil_cache.hpp"
+#include "trace.h"
+#include "variance.hpp"
 
 namespace rtnpr {
 
@@ -22,20 +30,121 @@ public:
     );
 
     void reset();
-private:
-    std::vector<Eigen::Vector3f> m_img;
-    std::vector<float> m_alpha_obj;
-    std::vector<float> m_alpha_line;
 
-    unsigned int m_spp = 0;
+    // Maps the accumulated buffers to img again without tracing, after a
+    // change of the display options only.
+    void resolve(std::vector<unsigned char> &img, const Options &opts);
 
-    void accumulate_and_write(
-            std::vector<unsigned char> &img,
-            unsigned int pix_id,
-            Eigen::Vector3f &L,
+    // samples accumulated per pixel since the last reset
+    [[nodiscard]] unsigned int spp() const { return m_spp; }
+
+    // counters and stage timings of the last call to step
+    [[nodiscard]] const stats::FrameStats &stats() const { return m_stats; }
+
+    // Records the next frames and their tiles as a Chrome trace, which
+    // write_trace() saves to path.
+    void start_trace() { m_trace.start(m_pool.size()); }
+    bool write_trace(const std::string &path) { return m_trace.write(path); }
+    [[nodiscard]] bool tracing() const { return m_trace.active(); }
+
+    // Blends the num_samples samples of this frame into the pixel loc_id of
+    // the tile. With opts.flr.line_only only the coverage is blended and L
+    // is ignored.
+    static void accumulate(
+            FrameBuffer::Tile &tile,
+            unsigned int loc_id,
+            const Eigen::Vector3f &L,
             float alpha_obj, float alpha_line,
+            unsigned int num_samples,
+            const Options &opts
+    );
+
+    // Writes the tone-mapped colors of the tile, which covers the pixels
+    // [iw0,iw1) x [ih0,ih1) of img, with the batched tone mapper.
+    static void resolve_tile(
+            std::vector<unsigned char> &img,
+            unsigned int width,
+            const FrameBuffer::Tile &tile,
+            unsigned int iw0, unsigned int ih0,
+            unsigned int iw1, unsigned int ih1,
+            const Options &opts
+    );
+
+private:
+    // Merges the moments of the samples of this frame into the variance of
+    // the pixel, before they are blended by accumulate.
+    static void accumulate_moments(
+            FrameBuffer::Tile &tile,
+            unsigned int loc_id,
+            const Moments &lum,
+            const Moments &line
+    );
+
+    // whether the error estimate of the pixel meets opts.rt.target_error
+    [[nodiscard]] static bool converged(
+            const FrameBuffer::Tile &tile,
+            unsigned int loc_id,
             const Options &opts
     );
+
+    // Starts the pixel loc_id of the tile, whose first sample is the ray
+    // that found hit, from the pixel of the previous view that saw the same
+    // point of the same primitive. The sample is off the pixel center by
+    // (jitter_w,jitter_h) in screen coordinates. Returns false, leaving the
+    // pixel cleared, when the point was out of view or occluded.
+    bool reproject_pixel(
+            FrameBuffer::Tile &tile,
+            unsigned int loc_id,
+            const Hit &hit, const Ray &ray,
+            float jitter_w, float jitter_h,
+            const Options &opts
+    ) const;
+
+    ThreadPool m_pool;
+    FrameBuffer m_fb;
+
+    // camera of the last frame, and the accumulation and camera of the view
+    // before a move with opts.rt.temporal
+    std::optional<Camera> m_camera;
+    std::optional<Camera> m_prev_camera;
+    FrameBuffer m_prev_fb;
+
+    // samples of the previous view a pixel keeps, so that view-dependent
+    // shading catches up with the move
+    static constexpr unsigned int max_history = 16;
+    // depth difference, relative to the depth, beyond which a pixel is disoccluded
+    static constexpr float max_depth_error = .05f;
+    // coverage of a pixel by the objects and the lines, below one or above
+    // zero, beyond which it is partly covered
+    static constexpr float max_coverage_error = .1f;
+
+    unsigned int m_spp = 0;
+
+    // samples per frame of the pixels still sampled, in units of spp_frame
+    static constexpr unsigned int max_boost = 8;
+    unsigned int m_boost = 1;
+
+    // per thread, with opts.flr.share_stencil
+    std::vector<StencilCache> m_stencil_cache;
+    // opts.scene.brdf flattened for the frame
+    std::vector<Material> m_materials;
+    // cells of the stencil cache across the radius of the stencil
+    static constexpr float stencil_cells_per_radius = 4.f;
+    // With opts.flr.adaptive_stencil, a pixel whose last quiet_samples
+    // samples found no line traces coarse_aux auxiliary rays only. A line
+    // found brings the full stencil back to the pixel, and from the next
+    // frame to its neighbours.
+    static constexpr unsigned int quiet_samples = 8;
+    static constexpr int coarse_aux = 3;
+    // per pixel of the image, whether its last sampled frame found a line,
+    // and the same as of the start of the frame
+    std::vector<uint8_t> m_lines;
+    std::vector<uint8_t> m_prev_lines;
+
+    std::vector<stats::ThreadStats> m_thread_stats;
+    stats::FrameStats m_stats;
+    Trace m_trace;
+    uint32_t m_frame = 0;
 };
 
 } // namespace rtnpr
\ No newline at end of file
@@ -1,25 +1,154 @@
 #pragma once
 
+#include <cstdint>
 #include <tuple>
-#include <random>
 
 #include "rtnpr_math.hpp"
+#include "bluenoise.hpp"
 
 namespace rtnpr {
 
+namespace rng {
+
+// PCG output permutation used as an integer hash
+// (Jarzynski & Olano, "Hash Functions for GPU Rendering", JCGT 2020)
+inline uint32_t pcg_hash(uint32_t v)
+{
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+inline uint32_t hash(uint32_t a, uint32_t b)
+{
+    return pcg_hash(a ^ pcg_hash(b));
+}
+
+inline uint32_t hash(uint32_t a, uint32_t b, uint32_t c)
+{
+    return pcg_hash(a ^ pcg_hash(b ^ pcg_hash(c)));
+}
+
+inline uint32_t reverse_bits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// first two dimensions of the Sobol sequence, as 32-bit fixed point
+inline uint32_t sobol(uint32_t index, uint32_t dim)
+{
+    if (dim == 0) { return reverse_bits(index); }
+    uint32_t x = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+        if (index & 1u) { x ^= v; }
+    }
+    return x;
+}
+
+// hash-based Owen scrambling
+// (Burley, "Practical Hash-based Owen Scrambling", JCGT 2020)
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+template<typename T>
+inline T to_unit(uint32_t bits)
+{
+    static_assert(std::is_floating_point_v<T>);
+    if constexpr (std::is_same_v<T,float>) { return float(bits >> 8) * 0x1p-24f; }
+    else { return T(bits) * T(0x1p-32); }
+}
+
+} // namespace rng
+
+enum class SamplerType {
+    Random = 0, Sobol = 1, BlueNoise = 2
+};
+
+// Sample dimensions are grouped in blocks so that every sampling decision
+// reads the same dimensions no matter which branches were taken before it.
+struct SampleBlock {
+    static constexpr uint32_t dims = 8;
+    // auxiliary rays of the line stencil that have dimensions of their own,
+    // the bound of opts.flr.n_aux
+    static constexpr int max_aux = 16;
+
+    static constexpr uint32_t pixel = 0;   // camera jitter
+    static constexpr uint32_t stencil = 1; // auxiliary disc rays, 2 dims each, up to max_aux rays
+    static constexpr uint32_t reflect = stencil + 2*max_aux/dims; // BRDF sample for reflected lines
+    static constexpr uint32_t bounce = 6;  // two blocks per bounce, light sample then BRDF sample
+};
+
+// Stateless, counter-based sampler. The value of the n-th dimension of a
+// pixel sample is a function of (seed, pixel, sample index, n) only, so
+// constructing one is free and renders are reproducible regardless of how
+// pixels map to threads.
+//  - Random: white noise from a PCG hash
+//  - Sobol: Owen-scrambled Sobol (0,2)-sequence, padded pairwise by shuffling the index
+//  - BlueNoise: Sobol scrambled identically for all pixels and rotated
+//    per pixel with a blue-noise mask, which pushes the error to high frequencies
 template<typename T>
 class UniformSampler {
 public:
-    UniformSampler() : rd(), gen(rd()), dis(T(0),T(1))
+    UniformSampler() = default;
+
+    UniformSampler(
+            SamplerType type, uint32_t seed,
+            uint32_t iw, uint32_t ih, uint32_t sample_id
+    ) : m_type(type), m_iw(iw), m_ih(ih), m_sample_id(sample_id)
     {
         static_assert(std::is_floating_point_v<T>);
+        const uint32_t pixel_key = rng::hash(seed, iw, ih);
+        m_key = rng::hash(pixel_key, sample_id);
+        m_scramble_key = type == SamplerType::BlueNoise ? rng::pcg_hash(seed) : pixel_key;
     }
 
-    T sample() { return dis(gen); }
+    void start_block(uint32_t block) { m_dim = block * SampleBlock::dims; }
+
+    // next dimension of the current block
+    T sample() { return sample_dim(m_dim++); }
+
+    // dimension of the current block reserved for discrete choices such as lobe selection
+    T sample_select() { return sample_dim((m_dim / SampleBlock::dims + 1) * SampleBlock::dims - 1); }
+
 private:
-    std::random_device rd;
-    std::mt19937 gen;
-    std::uniform_real_distribution<T> dis;
+    SamplerType m_type = SamplerType::Random;
+    uint32_t m_iw = 0;
+    uint32_t m_ih = 0;
+    uint32_t m_sample_id = 0;
+    uint32_t m_key = 0;
+    uint32_t m_scramble_key = 0;
+    uint32_t m_dim = 0;
+
+    T sample_dim(uint32_t dim) const
+    {
+        if (m_type == SamplerType::Random) {
+            return rng::to_unit<T>(rng::pcg_hash(m_key ^ (dim * 0x9e3779b9u)));
+        }
+
+        const uint32_t pair = dim >> 1;
+        const uint32_t index = rng::nested_uniform_scramble(m_sample_id, rng::hash(m_scramble_key, pair));
+        const uint32_t bits = rng::nested_uniform_scramble(
+                rng::sobol(index, dim & 1u), rng::hash(m_scramble_key, dim, 0xa511e9b3u));
+        T u = rng::to_unit<T>(bits);
+
+        if (m_type == SamplerType::BlueNoise) {
+            u += T(bluenoise::value(m_iw, m_ih, dim));
+            if (u >= T(1)) { u -= T(1); }
+        }
+        return u;
+    }
 };
 
 template<typename T>
@@ -42,4 +171,4 @@ std::pair<T,T> sample_pixel(
     return std::make_pair(cen_w+d_w, cen_h+d_h);
 }
 
-} // namespace rtnpr
\ No newline at end of file
+} // namespace rtnpr
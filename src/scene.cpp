@@ -0,0 +1,278 @@
+#include "scene.h"
+
+#include <bit>
+#include <cassert>
+
+#include <bvh/v2/bvh.h>
+#include <bvh/v2/vec.h>
+#include <bvh/v2/ray.h>
+#include <bvh/v2/node.h>
+#include <bvh/v2/default_builder.h>
+#include <bvh/v2/stack.h>
+
+#include "wide_bvh.hpp"
+#include "stats.hpp"
+
+
+namespace {
+
+using Scalar  = float;
+using Vec3    = bvh::v2::Vec<Scalar, 3>;
+using BBox    = bvh::v2::BBox<Scalar, 3>;
+using Node    = bvh::v2::Node<Scalar, 3>;
+using Bvh     = bvh::v2::Bvh<Node>;
+using Ray     = bvh::v2::Ray<Scalar, 3>;
+
+using rtnpr::bvh2::first_id;
+using rtnpr::bvh2::prim_count;
+
+} // namespace
+
+
+namespace rtnpr {
+
+// Top-level BVH whose primitives are the world bounds of the visible objects.
+class Scene::TLAS {
+public:
+    explicit TLAS(const std::vector<std::shared_ptr<Object>> &objects)
+    {
+        m_generations.reserve(objects.size());
+        m_visible.reserve(objects.size());
+        std::vector<::BBox> bboxes;
+        std::vector<::Vec3> centers;
+        for (int ii = 0; ii < objects.size(); ++ii) {
+            const auto &obj = objects[ii];
+            const auto box = obj->bounds();
+            m_generations.push_back(obj->generation());
+            m_visible.push_back(obj->visible);
+            if (!obj->visible || box.isEmpty()) { continue; }
+            const auto &lo = box.min();
+            const auto &hi = box.max();
+            bboxes.emplace_back(::Vec3(lo.x(),lo.y(),lo.z()), ::Vec3(hi.x(),hi.y(),hi.z()));
+            centers.push_back(bboxes.back().get_center());
+            m_obj_ids.push_back(ii);
+        }
+        if (bboxes.empty()) { return; }
+
+        // scenes hold few objects compared to meshes, a sequential build is enough
+        typename bvh::v2::DefaultBuilder<::Node>::Config config;
+        config.quality = bvh::v2::DefaultBuilder<::Node>::Quality::High;
+        config.min_leaf_size = 1;
+        config.max_leaf_size = 2;
+        m_bvh = bvh::v2::DefaultBuilder<::Node>::build(bboxes, centers, config);
+    }
+
+    [[nodiscard]] bool outdated(const std::vector<std::shared_ptr<Object>> &objects) const
+    {
+        if (objects.size() != m_generations.size()) { return true; }
+        for (int ii = 0; ii < objects.size(); ++ii) {
+            if (objects[ii]->visible != bool(m_visible[ii])) { return true; }
+            if (objects[ii]->generation() != m_generations[ii]) { return true; }
+        }
+        return false;
+    }
+
+    void ray_cast(
+            const std::vector<std::shared_ptr<Object>> &objects,
+            const rtnpr::Ray &_ray, Hit &hit
+    ) const {
+        if (m_bvh.nodes.empty()) { return; }
+
+        auto ray = ::Ray {
+                Vec3(_ray.org.x(), _ray.org.y(), _ray.org.z()),
+                Vec3(_ray.dir.x(), _ray.dir.y(), _ray.dir.z()),
+                _ray.tmin,
+                std::min(_ray.tmax, hit.dist)
+        };
+
+        static constexpr size_t stack_size = 64;
+        static constexpr bool use_robust_traversal = false;
+
+        uint64_t num_nodes = 0;
+        bvh::v2::SmallStack<::Bvh::Index, stack_size> stack;
+        bvh2::intersect<false, use_robust_traversal>(m_bvh, ray, stack,
+                                                     [&] (size_t begin, size_t end) {
+                                                         ++num_nodes;
+                                                         for (size_t i = begin; i < end; ++i) {
+                                                             const auto &obj = objects[m_obj_ids[m_bvh.prim_ids[i]]];
+                                                             obj->ray_cast(_ray, hit);
+                                                         }
+                                                         // closer objects cull the rest of the traversal
+                                                         ray.tmax = std::min(ray.tmax, hit.dist);
+                                                         return false;
+                                                     },
+                                                     [&] (auto &&...) { ++num_nodes; });
+        stats::add(stats::NodesVisited, num_nodes);
+    }
+
+    [[nodiscard]] bool occluded(
+            const std::vector<std::shared_ptr<Object>> &objects,
+            const rtnpr::Ray &_ray
+    ) const {
+        if (m_bvh.nodes.empty()) { return false; }
+
+        auto ray = ::Ray {
+                Vec3(_ray.org.x(), _ray.org.y(), _ray.org.z()),
+                Vec3(_ray.dir.x(), _ray.dir.y(), _ray.dir.z()),
+                _ray.tmin,
+                _ray.tmax
+        };
+
+        static constexpr size_t stack_size = 64;
+        static constexpr bool use_robust_traversal = false;
+
+        bool hit = false;
+        uint64_t num_nodes = 0;
+        bvh::v2::SmallStack<::Bvh::Index, stack_size> stack;
+        bvh2::intersect<true, use_robust_traversal>(m_bvh, ray, stack,
+                                                    [&] (size_t begin, size_t end) {
+                                                        ++num_nodes;
+                                                        for (size_t i = begin; i < end && !hit; ++i) {
+                                                            hit = objects[m_obj_ids[m_bvh.prim_ids[i]]]->occluded(_ray);
+                                                        }
+                                                        return hit;
+                                                    },
+                                                    [&] (auto &&...) { ++num_nodes; });
+        stats::add(stats::NodesVisited, num_nodes);
+        return hit;
+    }
+
+    void ray_cast_packet(
+            const std::vector<std::shared_ptr<Object>> &objects,
+            const rtnpr::Ray *rays, Hit *hits, int n
+    ) const {
+        if (m_bvh.nodes.empty()) { return; }
+
+        // up to 32 rays are tracked with a bit mask
+        static constexpr int max_rays = 32;
+        for (int i0 = 0; i0 < n; i0 += max_rays) {
+            const int cnt = std::min(n-i0, max_rays);
+            const rtnpr::Ray *r = rays + i0;
+            Hit *h = hits + i0;
+
+            float inv_dir[max_rays][3];
+            for (int k = 0; k < cnt; ++k) {
+                for (int a = 0; a < 3; ++a) { inv_dir[k][a] = 1.f / r[k].dir[a]; }
+            }
+
+            auto hit_mask = [&](const ::Node &node, uint32_t mask) {
+                uint32_t res = 0;
+                for (; mask; mask &= mask - 1) {
+                    const int k = std::countr_zero(mask);
+                    float tmin = r[k].tmin;
+                    float tmax = std::min(r[k].tmax, h[k].dist);
+                    for (int a = 0; a < 3; ++a) {
+                        const float ta = (node.bounds[2*a+0] - r[k].org[a]) * inv_dir[k][a];
+                        const float tb = (node.bounds[2*a+1] - r[k].org[a]) * inv_dir[k][a];
+                        tmin = std::max(tmin, std::min(ta, tb));
+                        tmax = std::min(tmax, std::max(ta, tb));
+                    }
+                    res |= uint32_t(tmin <= tmax) << k;
+                }
+                return res;
+            };
+
+            struct Entry { size_t node_id; uint32_t mask; };
+            static constexpr size_t stack_size = 64;
+            Entry stack[stack_size];
+            size_t stack_top = 0;
+            const uint32_t full_mask = cnt == max_rays ? ~0u : (1u << cnt) - 1u;
+            stack[stack_top++] = {0, full_mask};
+            rtnpr::Ray live_rays[max_rays];
+            Hit live_hits[max_rays];
+            uint64_t num_nodes = 0;
+
+            while (stack_top > 0) {
+                const auto [node_id, mask] = stack[--stack_top];
+                const auto &node = m_bvh.nodes[node_id];
+                ++num_nodes;
+                if (node.is_leaf()) {
+                    const size_t begin = first_id(node.index);
+                    const size_t end = begin + prim_count(node.index);
+                    // only the rays that reached the leaf go down the objects
+                    const rtnpr::Ray *lr = r;
+                    Hit *lh = h;
+                    int lcnt = cnt;
+                    if (mask != full_mask) {
+                        lcnt = 0;
+                        for (uint32_t m = mask; m; m &= m - 1) {
+                            const int k = std::countr_zero(m);
+                            live_rays[lcnt] = r[k];
+                            live_hits[lcnt++] = h[k];
+                        }
+                        lr = live_rays;
+                        lh = live_hits;
+                    }
+                    for (size_t i = begin; i < end; ++i) {
+                        const auto &obj = objects[m_obj_ids[m_bvh.prim_ids[i]]];
+                        obj->ray_cast_packet(lr, lh, lcnt);
+                    }
+                    if (mask != full_mask) {
+                        int j = 0;
+                        for (uint32_t m = mask; m; m &= m - 1) { h[std::countr_zero(m)] = live_hits[j++]; }
+                    }
+                    continue;
+                }
+                const size_t left_id = first_id(node.index);
+                const uint32_t mask_right = hit_mask(m_bvh.nodes[left_id+1], mask);
+                const uint32_t mask_left = hit_mask(m_bvh.nodes[left_id], mask);
+                assert(stack_top + 2 <= stack_size);
+                if (mask_right) { stack[stack_top++] = {left_id+1, mask_right}; }
+                if (mask_left) { stack[stack_top++] = {left_id, mask_left}; }
+            }
+            stats::add(stats::NodesVisited, num_nodes);
+        }
+    }
+
+private:
+    std::vector<uint64_t> m_generations;
+    std::vector<char> m_visible;
+    std::vector<int> m_obj_ids;
+    ::Bvh m_bvh;
+};
+
+void Scene::commit()
+{
+    for (const auto &obj: m_objects) { obj->refresh(); }
+    if (m_tlas && !m_tlas->outdated(m_objects)) { return; }
+    m_tlas = std::make_shared<const TLAS>(m_objects);
+}
+
+void Scene::ray_cast(const Ray &ray, Hit &hit) const
+{
+    if (!m_tlas) {
+        for (const auto &obj: m_objects) {
+            obj->ray_cast(ray,hit);
+        }
+        return;
+    }
+    // an object moved since the last commit()
+    assert(!m_tlas->outdated(m_objects));
+    m_tlas->ray_cast(m_objects, ray, hit);
+}
+
+bool Scene::occluded(const Ray &ray) const
+{
+    if (!m_tlas) {
+        for (const auto &obj: m_objects) {
+            if (obj->occluded(ray)) { return true; }
+        }
+        return false;
+    }
+    assert(!m_tlas->outdated(m_objects));
+    return m_tlas->occluded(m_objects, ray);
+}
+
+void Scene::ray_cast_packet(const Ray *rays, Hit *hits, int n) const
+{
+    if (!m_tlas) {
+        for (const auto &obj: m_objects) {
+            obj->ray_cast_packet(rays,hits,n);
+        }
+        return;
+    }
+    assert(!m_tlas->outdated(m_objects));
+    m_tlas->ray_cast_packet(m_objects, rays, hits, n);
+}
+
+} // namespace rtnpr
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <Eigen/Geometry>
+
+#include "object.hpp"
+
+namespace rtnpr {
+
+class Scene {
+public:
+    void add(std::shared_ptr<Object> obj)
+    {
+        obj->obj_id = m_objects.size();
+        m_objects.emplace_back(std::move(obj));
+        m_tlas.reset();
+    }
+
+    void clear()
+    {
+        m_objects.clear();
+        m_tlas.reset();
+    }
+
+    // Refreshes the objects, then rebuilds the top-level BVH over the world
+    // bounds of the visible objects if any of them moved, appeared or
+    // disappeared since the last call.
+    // Must be called after editing the objects and before casting rays; the
+    // queries assert that no object changed its generation() since.
+    void commit();
+
+    void ray_cast(const Ray &ray, Hit &hit) const;
+    void ray_cast_packet(const Ray *rays, Hit *hits, int n) const;
+
+    // any-hit query for shadow rays
+    [[nodiscard]] bool occluded(const Ray &ray) const;
+
+private:
+    std::vector<std::shared_ptr<Object>> m_objects;
+
+    class TLAS;
+    // immutable once built, so copies of the scene can share it
+    std::shared_ptr<const TLAS> m_tlas;
+};
+
+
+} // namespace rtnpr
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace rtnpr::stats {
+
+enum Counter {
+    PrimaryRays,
+    StencilRays,
+    ReflectRays,
+    ShadowRays,
+    BounceRays,
+    NodesVisited,   // inner nodes and leaves, a packet visiting a node counts once
+    TriangleTests,
+    SampledPixels,
+    SharedStencilRays,  // stencil rays answered by the StencilCache instead of traced
+    Samples,            // pixel samples, with the boost of the adaptive sampling
+    num_counters
+};
+
+enum Stage {
+    CameraRays,     // sampling and tracing the stencil from the camera
+    StencilTest,
+    PathTrace,
+    Resolve,        // accumulation and tone mapping
+    num_stages
+};
+
+inline constexpr const char *counter_names[num_counters] = {
+        "primary rays", "stencil rays", "reflect rays", "shadow rays", "bounce rays",
+        "bvh nodes", "triangle tests", "sampled pixels", "shared stencil", "samples"
+};
+
+inline constexpr const char *stage_names[num_stages] = {
+        "camera rays", "stencil_test", "ptrace", "resolve"
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Timestamp of the stage timers. Reading the clock on every stage of every
+// sample is too slow on some systems, so x86 reads the time stamp counter
+// and the ticks are converted with the rate measured over the frame.
+inline uint64_t ticks()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return uint64_t(Clock::now().time_since_epoch().count());
+#endif
+}
+
+// Counters of one thread. Each thread owns a whole cache line so that the
+// increments of neighbouring threads do not contend.
+struct alignas(64) ThreadStats {
+    uint64_t counters[num_counters] = {};
+    uint64_t stage_ticks[num_stages] = {};
+};
+
+// counters of the calling thread while it runs a task of RayTracer::step, null otherwise
+inline thread_local ThreadStats *local = nullptr;
+
+inline void add(Counter c, uint64_t n = 1)
+{
+    if (local) { local->counters[c] += n; }
+}
+
+// Charges the ticks elapsed since the previous lap to a stage, so that
+// back-to-back stages cost one read each.
+class StageTimer {
+public:
+    explicit StageTimer(ThreadStats &ts) : m_ts(ts), m_last(ticks()) {}
+
+    void lap(Stage stage)
+    {
+        const uint64_t now = ticks();
+        m_ts.stage_ticks[stage] += now - m_last;
+        m_last = now;
+    }
+
+private:
+    ThreadStats &m_ts;
+    uint64_t m_last;
+};
+
+// Totals of the last frame over all the threads.
+struct FrameStats {
+    uint64_t counters[num_counters] = {};
+    double stage_ms[num_stages] = {};   // thread time, summed over the threads
+    double frame_ms = 0.;               // wall time of the frame
+    unsigned int num_threads = 0;
+    unsigned int spp = 0;               // samples per pixel accumulated after the frame
+
+    [[nodiscard]] uint64_t rays() const
+    {
+        uint64_t n = 0;
+        for (int c = PrimaryRays; c <= BounceRays; ++c) { n += counters[c]; }
+        return n;
+    }
+
+    [[nodiscard]] double mrays_per_s() const
+    {
+        return frame_ms > 0. ? double(rays()) / (frame_ms * 1e3) : 0.;
+    }
+};
+
+} // namespace rtnpr::stats
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "hit.hpp"
+
+namespace rtnpr {
+
+// Hits of the camera rays traced for the pixels of one tile, on a grid of
+// cells finer than the line stencil. The auxiliary rays of neighbouring
+// pixels overlap, and a ray that falls in a cell already traced takes the hit
+// of the ray traced there instead of being traced again.
+// The entries are stamped with the generation of the tile they were traced
+// for, so that starting the next tile does not clear the grid.
+// Each sample index of a frame has a grid of its own. The samples of a pixel
+// never share hits with one another, only with the same sample of the other
+// pixels, so that they stay independent for the error estimate of the pixel.
+// Only the first max_layers samples have a grid, which bounds the memory to
+// max_layers x max_cells x max_cells hits; the others are not shared.
+class StencilCache {
+public:
+    // the grid is kept below max_cells x max_cells, larger cells beyond
+    static constexpr int max_cells = 256;
+    static constexpr int max_layers = 4;
+
+    // Starts caching the region [w0,w1) x [h0,h1) of the screen, in cells of
+    // at most cell_w x cell_h, for the samples 0..layers-1 of the pixels,
+    // up to max_layers.
+    void start(float w0, float h0, float w1, float h1, float cell_w, float cell_h, int layers)
+    {
+        m_w0 = w0;
+        m_h0 = h0;
+        m_nw = std::clamp(int(std::ceil((w1-w0) / cell_w)), 1, max_cells);
+        m_nh = std::clamp(int(std::ceil((h1-h0) / cell_h)), 1, max_cells);
+        m_inv_w = float(m_nw) / (w1-w0);
+        m_inv_h = float(m_nh) / (h1-h0);
+
+        m_layer_cells = size_t(m_nw) * m_nh;
+        m_layers = std::clamp(layers, 1, max_layers);
+        m_layer = 0;
+        const size_t n = m_layer_cells * m_layers;
+        if (m_gens.size() < n) {
+            m_gens.resize(n, 0);
+            m_hits.resize(n);
+        }
+        m_queue.clear();
+        if (++m_gen == 0) {
+            std::fill(m_gens.begin(), m_gens.end(), 0);
+            m_gen = 1;
+        }
+    }
+
+    // selects the grid of the sample index of the pixel, below max_layers
+    void select(int sample)
+    {
+        assert(m_queue.empty() && sample >= 0 && sample < m_layers);
+        m_layer = sample;
+    }
+
+    // The hit of a ray through the screen position (w,h) traced before for
+    // this tile and sample index. Otherwise null, and the ray is queued to be traced.
+    const Hit *lookup(float w, float h)
+    {
+        const int c = cell(w, h);
+        if (c >= 0 && m_gens[c] == m_gen) { return &m_hits[c]; }
+        m_queue.push_back(c);
+        return nullptr;
+    }
+
+    // queues a ray through (w,h) that is traced anyway
+    void queue(float w, float h) { m_queue.push_back(cell(w, h)); }
+
+    // Stores the hits of the queued rays, in the order they were queued, and
+    // empties the queue. The first hit of a cell is kept.
+    void insert(const Hit *hits)
+    {
+        for (size_t ii = 0; ii < m_queue.size(); ++ii) {
+            const int c = m_queue[ii];
+            if (c < 0 || m_gens[c] == m_gen) { continue; }
+            m_gens[c] = m_gen;
+            m_hits[c] = hits[ii];
+        }
+        m_queue.clear();
+    }
+
+private:
+    // cell of the screen position (w,h) in the selected grid, -1 outside the region
+    [[nodiscard]] int cell(float w, float h) const
+    {
+        const float x = (w - m_w0) * m_inv_w;
+        const float y = (h - m_h0) * m_inv_h;
+        if (x < 0.f || y < 0.f) { return -1; }
+        const int iw = int(x);
+        const int ih = int(y);
+        if (iw >= m_nw || ih >= m_nh) { return -1; }
+        return int(m_layer * m_layer_cells) + ih * m_nw + iw;
+    }
+
+    // the generations are apart from the hits so that the lookups of the
+    // cells not traced yet stay in cache
+    std::vector<uint32_t> m_gens;
+    std::vector<Hit> m_hits;
+    // cells of the rays to be traced, -1 for the rays outside the region
+    std::vector<int> m_queue;
+    uint32_t m_gen = 0;
+    float m_w0 = 0.f, m_h0 = 0.f;
+    float m_inv_w = 0.f, m_inv_h = 0.f;
+    int m_nw = 0, m_nh = 0;
+    size_t m_layer_cells = 0;
+    int m_layers = 1;
+    int m_layer = 0;
+};
+
+} // namespace rtnpr
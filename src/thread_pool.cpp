@@ -0,0 +1,138 @@
+#include "thread_pool.h"
+
+namespace {
+
+inline uint64_t pack(uint32_t begin, uint32_t end)
+{
+    return (uint64_t(begin) << 32) | uint64_t(end);
+}
+
+inline uint32_t range_begin(uint64_t range) { return uint32_t(range >> 32); }
+inline uint32_t range_end(uint64_t range) { return uint32_t(range); }
+
+} // namespace
+
+namespace rtnpr {
+
+ThreadPool::ThreadPool(unsigned int nthreads)
+{
+    if (nthreads == 0) { nthreads = std::thread::hardware_concurrency(); }
+    m_nthreads = nthreads > 0 ? nthreads : 1;
+    m_queues = std::make_unique<Queue[]>(m_nthreads);
+
+    // the calling thread acts as worker 0
+    m_workers.reserve(m_nthreads-1);
+    for (unsigned int tid = 1; tid < m_nthreads; ++tid) {
+        m_workers.emplace_back([this, tid]{ worker_loop(tid); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_quit = true;
+    }
+    m_cv_start.notify_all();
+    for (auto &worker: m_workers) { worker.join(); }
+}
+
+void ThreadPool::run(
+        unsigned int num_tasks,
+        const std::function<void(unsigned int, unsigned int)> &func
+) {
+    if (num_tasks == 0) { return; }
+
+    for (unsigned int tid = 0; tid < m_nthreads; ++tid) {
+        auto begin = uint32_t(uint64_t(num_tasks) * tid / m_nthreads);
+        auto end = uint32_t(uint64_t(num_tasks) * (tid+1) / m_nthreads);
+        m_queues[tid].range.store(pack(begin, end), std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_func = &func;
+        m_error = nullptr;
+        m_busy = m_nthreads-1;
+        ++m_generation;
+    }
+    m_cv_start.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_cv_done.wait(lock, [this]{ return m_busy == 0; });
+    m_func = nullptr;
+    if (m_error) { std::rethrow_exception(m_error); }
+}
+
+void ThreadPool::worker_loop(unsigned int tid)
+{
+    uint64_t generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv_start.wait(lock, [&]{ return m_quit || m_generation != generation; });
+            if (m_quit) { return; }
+            generation = m_generation;
+        }
+
+        work(tid);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (--m_busy > 0) { continue; }
+        }
+        m_cv_done.notify_one();
+    }
+}
+
+void ThreadPool::work(unsigned int tid)
+{
+    const auto &func = *m_func;
+    auto call = [&](unsigned int task) {
+        try {
+            func(task, tid);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (!m_error) { m_error = std::current_exception(); }
+        }
+    };
+
+    unsigned int task;
+    while (pop(tid, task)) { call(task); }
+
+    // own range is drained, help the others starting from the next thread
+    for (unsigned int ii = 1; ii < m_nthreads; ++ii) {
+        const unsigned int victim = (tid+ii) % m_nthreads;
+        while (steal(victim, task)) { call(task); }
+    }
+}
+
+bool ThreadPool::pop(unsigned int tid, unsigned int &task)
+{
+    auto &range = m_queues[tid].range;
+    uint64_t r = range.load(std::memory_order_relaxed);
+    while (range_begin(r) < range_end(r)) {
+        if (range.compare_exchange_weak(r, pack(range_begin(r)+1, range_end(r)))) {
+            task = range_begin(r);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::steal(unsigned int victim, unsigned int &task)
+{
+    auto &range = m_queues[victim].range;
+    uint64_t r = range.load(std::memory_order_relaxed);
+    while (range_begin(r) < range_end(r)) {
+        if (range.compare_exchange_weak(r, pack(range_begin(r), range_end(r)-1))) {
+            task = range_end(r)-1;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace rtnpr
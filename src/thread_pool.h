@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rtnpr {
+
+// Persistent pool of worker threads. The workers are parked on a condition
+// variable between calls to run(), so dispatching a frame does not pay for
+// spawning and joining threads. Tasks are split into one contiguous range per
+// thread; a thread that drains its own range steals from the back of the others.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int nthreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // number of threads taking part in run(), including the calling thread
+    [[nodiscard]] unsigned int size() const { return m_nthreads; }
+
+    // Calls func(task_id, thread_id) for every task_id in [0,num_tasks) and
+    // returns once all of them have finished. thread_id is in [0,size()).
+    void run(
+            unsigned int num_tasks,
+            const std::function<void(unsigned int, unsigned int)> &func
+    );
+
+private:
+    struct alignas(64) Queue {
+        // remaining task range [begin,end), packed as (begin << 32) | end
+        std::atomic<uint64_t> range{0};
+    };
+
+    unsigned int m_nthreads = 1;
+    std::unique_ptr<Queue[]> m_queues;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mtx;
+    std::condition_variable m_cv_start;
+    std::condition_variable m_cv_done;
+    uint64_t m_generation = 0;
+    unsigned int m_busy = 0;
+    bool m_quit = false;
+
+    const std::function<void(unsigned int, unsigned int)> *m_func = nullptr;
+    std::exception_ptr m_error;
+
+    void worker_loop(unsigned int tid);
+    void work(unsigned int tid);
+    bool pop(unsigned int tid, unsigned int &task);
+    bool steal(unsigned int victim, unsigned int &task);
+};
+
+} // namespace rtnpr
@@ -2,6 +2,12 @@
 
 #include "rtnpr_math.hpp"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace rtnpr {
 
 class ToneMapper {
@@ -15,39 +21,180 @@ public:
     Eigen::Vector3f lo_rgb{0.f,0.f,0.f};
 
     [[nodiscard]] Eigen::Vector3f map(float c, MapMode mode = MapMode::Reinhard) const
+    {
+        c = curve(c, mode, 1.2f);
+        return (1.f-c)*lo_rgb + c*hi_rgb;
+    }
+
+    [[nodiscard]] Eigen::Vector3f map3(Eigen::Vector3f c, MapMode mode = MapMode::Reinhard) const
+    {
+        for (int ii = 0; ii < 3; ++ii) { c[ii] = curve(c[ii], mode, 1.f); }
+        using namespace Eigen;
+        return (Vector3f::Ones()-c).cwiseProduct(lo_rgb) + c.cwiseProduct(hi_rgb);
+    }
+
+    // map3 over n pixels stored as planes: in[ch][i] to out[ch][i]
+    void map3_batch(const float *const in[3], float *const out[3], unsigned int n, MapMode mode) const
+    {
+        for (int ch = 0; ch < 3; ++ch) {
+            curve_batch(in[ch], out[ch], n, mode, 1.f);
+            blend(out[ch], out[ch], n, lo_rgb[ch], hi_rgb[ch]);
+        }
+    }
+
+    // map over n values: in[i] to out[ch][i]
+    void map_batch(const float *in, float *const out[3], unsigned int n, MapMode mode = MapMode::Reinhard) const
+    {
+        // out[0] holds the curve until the last channel is blended
+        curve_batch(in, out[0], n, mode, 1.2f);
+        blend(out[0], out[2], n, lo_rgb[2], hi_rgb[2]);
+        blend(out[0], out[1], n, lo_rgb[1], hi_rgb[1]);
+        blend(out[0], out[0], n, lo_rgb[0], hi_rgb[0]);
+    }
+
+    // same as math::to_u8 on each of the n values of in
+    static void quantize(const float *in, uint8_t *out, unsigned int n)
+    {
+        unsigned int i = 0;
+        // truncate, then let the saturating packs clip to [0,255]
+#if defined(__AVX2__)
+        const __m256 scale = _mm256_set1_ps(255.f);
+        for (; i + 8 <= n; i += 8) {
+            const __m256i k = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale));
+            const __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(k), _mm256_extracti128_si256(k, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(w, w));
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float32x4_t scale = vdupq_n_f32(255.f);
+        for (; i + 8 <= n; i += 8) {
+            const int32x4_t k0 = vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i), scale));
+            const int32x4_t k1 = vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i + 4), scale));
+            vst1_u8(out + i, vqmovn_u16(vcombine_u16(vqmovun_s32(k0), vqmovun_s32(k1))));
+        }
+#endif
+        for (; i < n; ++i) { out[i] = math::to_u8(in[i]); }
+    }
+
+private:
+    static constexpr float burn = 4.f;
+
+    // tone curve of one channel, clipped to [0,1]
+    [[nodiscard]] float curve(float c, MapMode mode, float sigmoid_gain) const
     {
         switch (mode) {
-            case MapMode::Sigmoid: c = math::sigmoid(c) * 1.2f; break;
-            case MapMode::Reinhard: c = math::tone_map_Reinhard(c, 4.f); break;
+            case MapMode::Sigmoid: c = math::sigmoid(c) * sigmoid_gain; break;
+            case MapMode::Reinhard: c = math::tone_map_Reinhard(c, burn); break;
             case MapMode::Cel: {
-                c = math::tone_map_Reinhard(c, 4.f);
+                c = math::tone_map_Reinhard(c, burn);
                 c = std::floor(c*cel_step)/cel_step;
                 break;
             }
         }
-        c = math::clip(c, 0.f, 1.f);
-        return (1.f-c)*lo_rgb + c*hi_rgb;
+        return math::clip(c, 0.f, 1.f);
     }
 
-    [[nodiscard]] Eigen::Vector3f map3(Eigen::Vector3f c, MapMode mode = MapMode::Reinhard) const
+    static void blend(const float *c, float *out, unsigned int n, float lo, float hi)
     {
-        switch (mode) {
-            case MapMode::Sigmoid: math::sigmoid3(c); break;
-            case MapMode::Reinhard: math::Reinhard3(c, 4.f); break;
-            case MapMode::Cel: {
-                math::Reinhard3(c, 4.f);
-                c *= cel_step;
-                math::floor3(c);
-                c /= cel_step;
-                break;
+        for (unsigned int i = 0; i < n; ++i) { out[i] = (1.f-c[i])*lo + c[i]*hi; }
+    }
+
+    // The vector kernels evaluate the curves in single precision, with a
+    // polynomial exp for the sigmoid, and agree with curve() to a few ulps.
+    void curve_batch(const float *in, float *out, unsigned int n, MapMode mode, float sigmoid_gain) const
+    {
+        unsigned int i = 0;
+#if defined(__AVX2__)
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 inv_burn2 = _mm256_set1_ps(1.f/(burn*burn));
+        auto reinhard = [&](__m256 c) {
+            const __m256 num = _mm256_mul_ps(c, _mm256_add_ps(one, _mm256_mul_ps(c, inv_burn2)));
+            return _mm256_div_ps(num, _mm256_add_ps(one, c));
+        };
+        for (; i + 8 <= n; i += 8) {
+            __m256 c = _mm256_loadu_ps(in + i);
+            switch (mode) {
+                case MapMode::Sigmoid: {
+                    const __m256 e = exp256(_mm256_sub_ps(zero, c));
+                    const __m256 s = _mm256_sub_ps(_mm256_div_ps(one, _mm256_add_ps(one, e)), _mm256_set1_ps(.5f));
+                    c = _mm256_mul_ps(_mm256_set1_ps(2.f*sigmoid_gain), _mm256_max_ps(zero, s));
+                    break;
+                }
+                case MapMode::Reinhard: c = reinhard(c); break;
+                case MapMode::Cel: {
+                    const __m256 step = _mm256_set1_ps(cel_step);
+                    c = _mm256_div_ps(_mm256_floor_ps(_mm256_mul_ps(reinhard(c), step)), step);
+                    break;
+                }
             }
+            _mm256_storeu_ps(out + i, _mm256_min_ps(one, _mm256_max_ps(zero, c)));
         }
-        math::clip3(c, 0.f, 1.f);
-        using namespace Eigen;
-        return (Vector3f::Ones()-c).cwiseProduct(lo_rgb) + c.cwiseProduct(hi_rgb);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float32x4_t zero = vdupq_n_f32(0.f);
+        const float32x4_t one = vdupq_n_f32(1.f);
+        const float32x4_t inv_burn2 = vdupq_n_f32(1.f/(burn*burn));
+        auto reinhard = [&](float32x4_t c) {
+            const float32x4_t num = vmulq_f32(c, vaddq_f32(one, vmulq_f32(c, inv_burn2)));
+            return vdivq_f32(num, vaddq_f32(one, c));
+        };
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t c = vld1q_f32(in + i);
+            switch (mode) {
+                case MapMode::Sigmoid: {
+                    const float32x4_t e = exp128(vnegq_f32(c));
+                    const float32x4_t s = vsubq_f32(vdivq_f32(one, vaddq_f32(one, e)), vdupq_n_f32(.5f));
+                    c = vmulq_f32(vdupq_n_f32(2.f*sigmoid_gain), vmaxq_f32(zero, s));
+                    break;
+                }
+                case MapMode::Reinhard: c = reinhard(c); break;
+                case MapMode::Cel: {
+                    const float32x4_t step = vdupq_n_f32(cel_step);
+                    c = vdivq_f32(vrndmq_f32(vmulq_f32(reinhard(c), step)), step);
+                    break;
+                }
+            }
+            vst1q_f32(out + i, vminq_f32(one, vmaxq_f32(zero, c)));
+        }
+#endif
+        for (; i < n; ++i) { out[i] = curve(in[i], mode, sigmoid_gain); }
     }
-private:
 
+    // exp(x) with the Cephes polynomial, relative error below 2e-7
+#if defined(__AVX2__)
+    static __m256 exp256(__m256 x)
+    {
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.3f));
+        const __m256 fx = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _mm256_set1_ps(.5f)));
+        x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(.693359375f)));
+        x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+        __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.3981999507e-3f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(8.3334519073e-3f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(4.1665795894e-2f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.6666665459e-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(5.0000001201e-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(y, x), x), _mm256_add_ps(x, _mm256_set1_ps(1.f)));
+        const __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static float32x4_t exp128(float32x4_t x)
+    {
+        x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-87.3f)), vdupq_n_f32(88.3f));
+        const float32x4_t fx = vrndmq_f32(vaddq_f32(vmulq_f32(x, vdupq_n_f32(1.44269504088896341f)), vdupq_n_f32(.5f)));
+        x = vsubq_f32(x, vmulq_f32(fx, vdupq_n_f32(.693359375f)));
+        x = vsubq_f32(x, vmulq_f32(fx, vdupq_n_f32(-2.12194440e-4f)));
+        float32x4_t y = vdupq_n_f32(1.9875691500e-4f);
+        y = vaddq_f32(vmulq_f32(y, x), vdupq_n_f32(1.3981999507e-3f));
+        y = vaddq_f32(vmulq_f32(y, x), vdupq_n_f32(8.3334519073e-3f));
+        y = vaddq_f32(vmulq_f32(y, x), vdupq_n_f32(4.1665795894e-2f));
+        y = vaddq_f32(vmulq_f32(y, x), vdupq_n_f32(1.6666665459e-1f));
+        y = vaddq_f32(vmulq_f32(y, x), vdupq_n_f32(5.0000001201e-1f));
+        y = vaddq_f32(vmulq_f32(vmulq_f32(y, x), x), vaddq_f32(x, vdupq_n_f32(1.f)));
+        const int32x4_t e = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(fx), vdupq_n_s32(127)), 23);
+        return vmulq_f32(y, vreinterpretq_f32_s32(e));
+    }
+#endif
 };
 
-} // namespace rtnpr
\ No newline at end of file
+} // namespace rtnpr
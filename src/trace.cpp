@@ -0,0 +1,63 @@
+#include "trace.h"
+
+#include <cassert>
+#include <cstdio>
+
+namespace rtnpr {
+
+void Trace::start(unsigned int num_threads)
+{
+    m_buffers.clear();
+    m_buffers.resize(num_threads);
+    m_origin = stats::Clock::now();
+    m_active = true;
+}
+
+void Trace::stop()
+{
+    m_buffers.clear();
+    m_active = false;
+}
+
+void Trace::record(
+        unsigned int tid, const char *name, uint32_t id,
+        stats::Clock::time_point begin, stats::Clock::time_point end
+) {
+    if (!m_active) { return; }
+    assert(tid < m_buffers.size());
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    m_buffers[tid].events.push_back({
+            name, id,
+            duration_cast<nanoseconds>(begin - m_origin).count(),
+            duration_cast<nanoseconds>(end - begin).count()
+    });
+}
+
+bool Trace::write(const std::string &path)
+{
+    FILE *fp = std::fopen(path.c_str(), "w");
+    if (!fp) {
+        stop();
+        return false;
+    }
+
+    // timestamps of the format are in microseconds
+    std::fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (unsigned int tid = 0; tid < m_buffers.size(); ++tid) {
+        std::fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}}",
+                     first ? "" : ",\n", tid, tid);
+        first = false;
+        for (const auto &e: m_buffers[tid].events) {
+            std::fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%u}}",
+                         e.name, tid, double(e.begin_ns)*1e-3, double(e.dur_ns)*1e-3, e.id);
+        }
+    }
+    std::fprintf(fp, "\n]}\n");
+
+    stop();
+    return std::fclose(fp) == 0;
+}
+
+} // namespace rtnpr
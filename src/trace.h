@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "stats.hpp"
+
+namespace rtnpr {
+
+// Records the frames and the tiles rendered by RayTracer::step as complete
+// events of the Chrome trace format, to be inspected in chrome://tracing or
+// Perfetto. Each thread appends to its own buffer, so recording takes no lock.
+class Trace {
+public:
+    // starts recording from scratch, with one buffer per thread of the pool
+    void start(unsigned int num_threads);
+
+    // stops recording and drops the events
+    void stop();
+
+    [[nodiscard]] bool active() const { return m_active; }
+
+    // called by thread tid only; id is the frame or the tile id
+    void record(
+            unsigned int tid, const char *name, uint32_t id,
+            stats::Clock::time_point begin, stats::Clock::time_point end
+    );
+
+    // Writes the events recorded so far as JSON and stops recording.
+    bool write(const std::string &path);
+
+private:
+    struct Event {
+        const char *name;
+        uint32_t id;
+        int64_t begin_ns;
+        int64_t dur_ns;
+    };
+
+    struct alignas(64) Buffer {
+        std::vector<Event> events;
+    };
+
+    bool m_active = false;
+    stats::Clock::time_point m_origin;
+    std::vector<Buffer> m_buffers;
+};
+
+} // namespace rtnpr
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rtnpr_math.hpp"
+#include "ray.hpp"
 
 #include <Eigen/Geometry>
 
@@ -21,4 +22,60 @@ public:
     }
 };
 
-} // namespace rtnpr
\ No newline at end of file
+// Rotation with uniform scale and shift, x -> scale * rot * x + shift.
+// Rays are moved into the local frame instead of the geometry being moved
+// into the world, so changing it does not require rebuilding anything.
+struct Similarity {
+public:
+    Eigen::Matrix3f rot = Eigen::Matrix3f::Identity();
+    Eigen::Vector3f shift = Eigen::Vector3f::Zero();
+    float scale = 1.f;
+
+    Similarity() = default;
+
+    explicit Similarity(const Transform &t)
+            : rot(t.rot()), shift(t.shift), scale(t.scale) {}
+
+    // this applied after b
+    [[nodiscard]] Similarity operator*(const Similarity &b) const
+    {
+        Similarity c;
+        c.rot = rot * b.rot;
+        c.shift = scale * (rot * b.shift) + shift;
+        c.scale = scale * b.scale;
+        return c;
+    }
+
+    // The direction is not normalized so that the distance along the ray is
+    // the same in both frames, and hits compare with the ones of other objects.
+    [[nodiscard]] Ray to_local(const Ray &ray) const
+    {
+        using namespace Eigen;
+        const float inv_scale = 1.f / scale;
+        const Vector3f org = inv_scale * (rot.transpose() * (ray.org - shift));
+        const Vector3f dir = inv_scale * (rot.transpose() * ray.dir);
+        Ray local(org, dir);
+        local.tmin = ray.tmin;
+        local.tmax = ray.tmax;
+        return local;
+    }
+
+    [[nodiscard]] Eigen::Vector3f normal_to_world(const Eigen::Vector3f &nrm) const
+    {
+        return (rot * nrm).normalized();
+    }
+
+    [[nodiscard]] Eigen::AlignedBox3f to_world(const Eigen::AlignedBox3f &box) const
+    {
+        using namespace Eigen;
+        AlignedBox3f res;
+        if (box.isEmpty()) { return res; }
+        for (int ii = 0; ii < 8; ++ii) {
+            const Vector3f corner = box.corner(AlignedBox3f::CornerType(ii));
+            res.extend(scale * (rot * corner) + shift);
+        }
+        return res;
+    }
+};
+
+} // namespace rtnpr
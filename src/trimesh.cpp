@@ -10,8 +10,16 @@
 #include <bvh/v2/stack.h>
 #include <bvh/v2/tri.h>
 
+#include <bit>
 #include <iostream>
 
+#include "wide_bvh.hpp"
+#include "stats.hpp"
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 
 namespace {
 
@@ -25,6 +33,120 @@ using Ray     = bvh::v2::Ray<Scalar, 3>;
 
 using PrecomputedTri = bvh::v2::PrecomputedTri<Scalar>;
 
+using rtnpr::bvh2::first_id;
+using rtnpr::bvh2::prim_count;
+
+// Rays of a packet in SoA layout. Lanes past the number of rays are padded
+// with an empty [tmin,tmax] interval so that they never hit anything.
+template<int N>
+struct alignas(64) RayPacket {
+    static_assert(N % 4 == 0 && N <= 32);
+    Scalar org[3][N];
+    Scalar dir[3][N];
+    Scalar inv_dir[3][N];
+    Scalar tmin[N];
+    Scalar tmax[N];
+    size_t prim_id[N];
+};
+
+// Slab test of all the lanes against a node. Returns the lanes hitting the
+// node and their entry distances in t0.
+template<int N>
+uint32_t intersect_node(const ::Node &node, const RayPacket<N> &p, Scalar *t0)
+{
+    const auto &b = node.bounds;
+    uint32_t mask = 0;
+#if defined(__AVX512F__)
+    if constexpr (N % 16 == 0) {
+        for (int k = 0; k < N; k += 16) {
+            __m512 tmin = _mm512_load_ps(p.tmin+k);
+            __m512 tmax = _mm512_load_ps(p.tmax+k);
+            for (int a = 0; a < 3; ++a) {
+                const __m512 org = _mm512_load_ps(p.org[a]+k);
+                const __m512 inv = _mm512_load_ps(p.inv_dir[a]+k);
+                const __m512 ta = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(b[2*a+0]), org), inv);
+                const __m512 tb = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(b[2*a+1]), org), inv);
+                tmin = _mm512_max_ps(tmin, _mm512_min_ps(ta, tb));
+                tmax = _mm512_min_ps(tmax, _mm512_max_ps(ta, tb));
+            }
+            _mm512_store_ps(t0+k, tmin);
+            mask |= uint32_t(_mm512_cmp_ps_mask(tmin, tmax, _CMP_LE_OQ)) << k;
+        }
+        return mask;
+    }
+#endif
+#if defined(__AVX2__)
+    if constexpr (N % 8 == 0) {
+        for (int k = 0; k < N; k += 8) {
+            __m256 tmin = _mm256_load_ps(p.tmin+k);
+            __m256 tmax = _mm256_load_ps(p.tmax+k);
+            for (int a = 0; a < 3; ++a) {
+                const __m256 org = _mm256_load_ps(p.org[a]+k);
+                const __m256 inv = _mm256_load_ps(p.inv_dir[a]+k);
+                const __m256 ta = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b[2*a+0]), org), inv);
+                const __m256 tb = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b[2*a+1]), org), inv);
+                tmin = _mm256_max_ps(tmin, _mm256_min_ps(ta, tb));
+                tmax = _mm256_min_ps(tmax, _mm256_max_ps(ta, tb));
+            }
+            _mm256_store_ps(t0+k, tmin);
+            mask |= uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ))) << k;
+        }
+        return mask;
+    }
+#endif
+    for (int k = 0; k < N; ++k) {
+        Scalar tmin = p.tmin[k];
+        Scalar tmax = p.tmax[k];
+        for (int a = 0; a < 3; ++a) {
+            const Scalar ta = (b[2*a+0] - p.org[a][k]) * p.inv_dir[a][k];
+            const Scalar tb = (b[2*a+1] - p.org[a][k]) * p.inv_dir[a][k];
+            tmin = std::max(tmin, std::min(ta, tb));
+            tmax = std::min(tmax, std::max(ta, tb));
+        }
+        t0[k] = tmin;
+        mask |= uint32_t(tmin <= tmax) << k;
+    }
+    return mask;
+}
+
+// Same test as PrecomputedTri::intersect, run branch-free on all the lanes in mask.
+template<int N>
+void intersect_tri(const ::PrecomputedTri &tri, size_t prim_id, uint32_t mask, RayPacket<N> &p)
+{
+    static constexpr Scalar tolerance = -std::numeric_limits<Scalar>::epsilon();
+    for (int k = 0; k < N; ++k) {
+        const Scalar cx = tri.p0[0] - p.org[0][k];
+        const Scalar cy = tri.p0[1] - p.org[1][k];
+        const Scalar cz = tri.p0[2] - p.org[2][k];
+        const Scalar rx = p.dir[1][k]*cz - p.dir[2][k]*cy;
+        const Scalar ry = p.dir[2][k]*cx - p.dir[0][k]*cz;
+        const Scalar rz = p.dir[0][k]*cy - p.dir[1][k]*cx;
+        const Scalar inv_det = Scalar(1) / (tri.n[0]*p.dir[0][k] + tri.n[1]*p.dir[1][k] + tri.n[2]*p.dir[2][k]);
+        const Scalar u = (rx*tri.e2[0] + ry*tri.e2[1] + rz*tri.e2[2]) * inv_det;
+        const Scalar v = (rx*tri.e1[0] + ry*tri.e1[1] + rz*tri.e1[2]) * inv_det;
+        const Scalar w = Scalar(1) - u - v;
+        const Scalar t = (tri.n[0]*cx + tri.n[1]*cy + tri.n[2]*cz) * inv_det;
+        const bool hit = ((mask >> k) & 1u)
+                && u >= tolerance && v >= tolerance && w >= tolerance
+                && t >= p.tmin[k] && t <= p.tmax[k];
+        p.tmax[k] = hit ? t : p.tmax[k];
+        p.prim_id[k] = hit ? prim_id : p.prim_id[k];
+    }
+}
+
+// shared by all the builds and refits instead of spawning threads every time
+bvh::v2::ThreadPool &thread_pool()
+{
+    static bvh::v2::ThreadPool pool;
+    return pool;
+}
+
+float half_area(const float lo[3], const float hi[3])
+{
+    const float dx = hi[0]-lo[0], dy = hi[1]-lo[1], dz = hi[2]-lo[2];
+    return dx*dy + dy*dz + dz*dx;
+}
+
 } // namespace
 
 
@@ -32,7 +154,10 @@ namespace rtnpr {
 
 class TriMesh::BVH {
 public:
-    BVH(const Eigen::MatrixXf &V, const Eigen::MatrixXi &F)
+    const BvhLayout layout;
+
+    BVH(const Eigen::MatrixXf &V, const Eigen::MatrixXi &F, BvhLayout _layout)
+            : layout(_layout)
     {
         using namespace Eigen;
 
@@ -48,8 +173,7 @@ public:
             );
         }
 
-        bvh::v2::ThreadPool thread_pool;
-        bvh::v2::ParallelExecutor executor(thread_pool);
+        bvh::v2::ParallelExecutor executor(thread_pool());
 
         // Get triangle centers and bounding boxes (required for BVH builder)
         std::vector<::BBox> bboxes(tris.size());
@@ -63,7 +187,7 @@ public:
 
         typename bvh::v2::DefaultBuilder<::Node>::Config config;
         config.quality = bvh::v2::DefaultBuilder<::Node>::Quality::High;
-        m_bvh = std::make_unique<::Bvh>(bvh::v2::DefaultBuilder<::Node>::build(thread_pool, bboxes, centers, config));
+        m_bvh = std::make_unique<::Bvh>(bvh::v2::DefaultBuilder<::Node>::build(thread_pool(), bboxes, centers, config));
 
         // This precomputes some data to speed up traversal further.
         m_precomputed_tris.resize(tris.size());
@@ -73,6 +197,114 @@ public:
                 m_precomputed_tris[i] = tris[j];
             }
         });
+
+        // the wide trees replace the binary one, only the leaf layout is kept
+        if (layout != BvhLayout::Binary) {
+            if (layout == BvhLayout::Wide4) { m_wide4.build(*m_bvh); }
+            else { m_wide8.build(*m_bvh); }
+            m_bvh->nodes.clear();
+            m_bvh->nodes.shrink_to_fit();
+        } else {
+            build_levels();
+        }
+        m_built_cost = sah_cost();
+    }
+
+    // Moves the triangles to the new positions of the vertices and refits the
+    // bounds of the nodes bottom-up, one level of the tree at a time. Returns
+    // false once the SAH cost degraded enough that a rebuild pays off.
+    bool refit(const Eigen::MatrixXf &V, const Eigen::MatrixXi &F)
+    {
+        bvh::v2::ParallelExecutor executor(thread_pool());
+
+        auto vertex = [&](size_t face, int k) {
+            const auto &p = V.row(F(face,k));
+            return ::Vec3(p.x(),p.y(),p.z());
+        };
+        executor.for_each(0, m_precomputed_tris.size(), [&] (size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                auto j = m_should_permute ? m_bvh->prim_ids[i] : i;
+                m_precomputed_tris[i] = ::Tri(vertex(j,0), vertex(j,1), vertex(j,2));
+            }
+        });
+
+        // leaves refer to the primitives by their position in prim_ids
+        auto leaf_bounds = [&](size_t begin, size_t end, float lo[3], float hi[3]) {
+            for (int a = 0; a < 3; ++a) {
+                lo[a] = std::numeric_limits<float>::max();
+                hi[a] = -std::numeric_limits<float>::max();
+            }
+            for (size_t i = begin; i < end; ++i) {
+                const auto face = m_bvh->prim_ids[i];
+                for (int k = 0; k < 3; ++k) {
+                    for (int a = 0; a < 3; ++a) {
+                        const float x = V(F(face,k),a);
+                        lo[a] = std::min(lo[a], x);
+                        hi[a] = std::max(hi[a], x);
+                    }
+                }
+            }
+        };
+
+        switch (layout) {
+            case BvhLayout::Binary: {
+                auto &nodes = m_bvh->nodes;
+                for (size_t lv = m_level_offsets.size()-1; lv-- > 0;) {
+                    executor.for_each(m_level_offsets[lv], m_level_offsets[lv+1], [&] (size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; ++i) {
+                            auto &node = nodes[m_level_nodes[i]];
+                            if (node.is_leaf()) {
+                                const size_t first = first_id(node.index);
+                                float lo[3], hi[3];
+                                leaf_bounds(first, first + prim_count(node.index), lo, hi);
+                                for (int a = 0; a < 3; ++a) {
+                                    node.bounds[2*a+0] = lo[a];
+                                    node.bounds[2*a+1] = hi[a];
+                                }
+                            } else {
+                                const auto &left = nodes[first_id(node.index)];
+                                const auto &right = nodes[first_id(node.index)+1];
+                                for (int a = 0; a < 3; ++a) {
+                                    node.bounds[2*a+0] = std::min(left.bounds[2*a+0], right.bounds[2*a+0]);
+                                    node.bounds[2*a+1] = std::max(left.bounds[2*a+1], right.bounds[2*a+1]);
+                                }
+                            }
+                        }
+                    });
+                }
+                break;
+            }
+            case BvhLayout::Wide4:
+            case BvhLayout::Wide8: {
+                auto for_each = [&](size_t begin, size_t end, const auto &loop) { executor.for_each(begin, end, loop); };
+                if (layout == BvhLayout::Wide4) { m_wide4.refit(leaf_bounds, for_each); }
+                else { m_wide8.refit(leaf_bounds, for_each); }
+                break;
+            }
+        }
+        return sah_cost() <= max_sah_degradation * m_built_cost;
+    }
+
+    // cost of traversing the tree relative to the area of the root, per the surface area heuristic
+    [[nodiscard]] float sah_cost() const
+    {
+        switch (layout) {
+            case BvhLayout::Wide4: return m_wide4.sah_cost();
+            case BvhLayout::Wide8: return m_wide8.sah_cost();
+            default: break;
+        }
+        const auto &nodes = m_bvh->nodes;
+        if (nodes.empty()) { return 0.f; }
+        auto area = [](const ::Node &node) {
+            const float lo[3] = {node.bounds[0], node.bounds[2], node.bounds[4]};
+            const float hi[3] = {node.bounds[1], node.bounds[3], node.bounds[5]};
+            return half_area(lo, hi);
+        };
+        float cost = 0.f;
+        for (const auto &node: nodes) {
+            cost += area(node) * (node.is_leaf() ? float(prim_count(node.index)) : 1.f);
+        }
+        return cost / area(nodes[0]);
     }
 
     bool ray_cast(const Ray &_ray, size_t &tri_id, float &dist, Eigen::Vector3f &nrm)
@@ -94,19 +326,33 @@ public:
         auto prim_id = invalid_id;
         Scalar u, v;
 
+        uint64_t num_nodes = 0, num_tests = 0;
+        auto inner_fn = [&] (auto &&...) { ++num_nodes; };
+        auto leaf_fn = [&] (size_t begin, size_t end) {
+            ++num_nodes;
+            num_tests += end-begin;
+            for (size_t i = begin; i < end; ++i) {
+                size_t j = m_should_permute ? i : bvh.prim_ids[i];
+                if (auto hit = m_precomputed_tris[j].intersect(ray)) {
+                    prim_id = i;
+                    std::tie(u, v) = *hit;
+                }
+            }
+            return prim_id != invalid_id;
+        };
+
         // Traverse the BVH and get the u, v coordinates of the closest intersection.
-        bvh::v2::SmallStack<::Bvh::Index, stack_size> stack;
-        bvh.intersect<false, use_robust_traversal>(ray, bvh.get_root().index, stack,
-                                                   [&] (size_t begin, size_t end) {
-                                                       for (size_t i = begin; i < end; ++i) {
-                                                           size_t j = m_should_permute ? i : bvh.prim_ids[i];
-                                                           if (auto hit = m_precomputed_tris[j].intersect(ray)) {
-                                                               prim_id = i;
-                                                               std::tie(u, v) = *hit;
-                                                           }
-                                                       }
-                                                       return prim_id != invalid_id;
-                                                   });
+        switch (layout) {
+            case BvhLayout::Binary: {
+                bvh::v2::SmallStack<::Bvh::Index, stack_size> stack;
+                bvh2::intersect<false, use_robust_traversal>(bvh, ray, stack, leaf_fn, inner_fn);
+                break;
+            }
+            case BvhLayout::Wide4: m_wide4.intersect<false>(ray, leaf_fn, inner_fn); break;
+            case BvhLayout::Wide8: m_wide8.intersect<false>(ray, leaf_fn, inner_fn); break;
+        }
+        stats::add(stats::NodesVisited, num_nodes);
+        stats::add(stats::TriangleTests, num_tests);
 
         if (prim_id != invalid_id) {
             auto &n = m_precomputed_tris[prim_id].n;
@@ -125,50 +371,318 @@ public:
         }
     }
 
+    // Stops at the first intersection found instead of looking for the closest one.
+    bool occluded(const Ray &_ray) const
+    {
+        auto ray = ::Ray {
+                Vec3(_ray.org.x(), _ray.org.y(), _ray.org.z()),
+                Vec3(_ray.dir.x(), _ray.dir.y(), _ray.dir.z()),
+                _ray.tmin,
+                _ray.tmax
+        };
+
+        static constexpr size_t stack_size = 64;
+        static constexpr bool use_robust_traversal = false;
+
+        bool hit = false;
+        uint64_t num_nodes = 0, num_tests = 0;
+        auto inner_fn = [&] (auto &&...) { ++num_nodes; };
+        auto leaf_fn = [&] (size_t begin, size_t end) {
+            ++num_nodes;
+            for (size_t i = begin; i < end && !hit; ++i) {
+                size_t j = m_should_permute ? i : m_bvh->prim_ids[i];
+                hit = m_precomputed_tris[j].intersect(ray).has_value();
+                ++num_tests;
+            }
+            return hit;
+        };
+
+        switch (layout) {
+            case BvhLayout::Binary: {
+                bvh::v2::SmallStack<::Bvh::Index, stack_size> stack;
+                bvh2::intersect<true, use_robust_traversal>(*m_bvh, ray, stack, leaf_fn, inner_fn);
+                break;
+            }
+            case BvhLayout::Wide4: m_wide4.intersect<true>(ray, leaf_fn, inner_fn); break;
+            case BvhLayout::Wide8: m_wide8.intersect<true>(ray, leaf_fn, inner_fn); break;
+        }
+        stats::add(stats::NodesVisited, num_nodes);
+        stats::add(stats::TriangleTests, num_tests);
+        return hit;
+    }
+
+    // Traces all the lanes of the packet together: a node is visited once
+    // for the whole packet, with the mask of the lanes that hit it.
+    template<int N>
+    void ray_cast(RayPacket<N> &p) const
+    {
+        if (!m_bvh) { return; }
+        const auto &nodes = m_bvh->nodes;
+
+        struct Entry { size_t node_id; uint32_t mask; };
+        static constexpr size_t stack_size = 64;
+        Entry stack[stack_size];
+        size_t stack_top = 0;
+
+        alignas(64) Scalar t_left[N];
+        alignas(64) Scalar t_right[N];
+
+        uint64_t num_nodes = 0, num_tests = 0;
+        stack[stack_top++] = {0, ~0u};
+        while (stack_top > 0) {
+            auto [node_id, mask] = stack[--stack_top];
+            // lanes may have found closer hits since the node was pushed
+            mask &= intersect_node(nodes[node_id], p, t_left);
+            if (!mask) { continue; }
+
+            while (!nodes[node_id].is_leaf()) {
+                ++num_nodes;
+                const size_t left_id = first_id(nodes[node_id].index);
+                const size_t right_id = left_id + 1;
+                const uint32_t mask_left = mask & intersect_node(nodes[left_id], p, t_left);
+                const uint32_t mask_right = mask & intersect_node(nodes[right_id], p, t_right);
+                if (mask_left && mask_right) {
+                    // go to the child that is closer for the first lane hitting both
+                    size_t near_id = left_id, far_id = right_id;
+                    uint32_t near_mask = mask_left, far_mask = mask_right;
+                    if (const uint32_t both = mask_left & mask_right) {
+                        const int k = std::countr_zero(both);
+                        if (t_right[k] < t_left[k]) {
+                            std::swap(near_id, far_id);
+                            std::swap(near_mask, far_mask);
+                        }
+                    }
+                    assert(stack_top < stack_size);
+                    stack[stack_top++] = {far_id, far_mask};
+                    node_id = near_id;
+                    mask = near_mask;
+                }
+                else if (mask_left) { node_id = left_id; mask = mask_left; }
+                else if (mask_right) { node_id = right_id; mask = mask_right; }
+                else { mask = 0; break; }
+            }
+            if (!mask) { continue; }
+
+            const auto &index = nodes[node_id].index;
+            const size_t begin = first_id(index);
+            const size_t end = begin + prim_count(index);
+            for (size_t i = begin; i < end; ++i) {
+                size_t j = m_should_permute ? i : m_bvh->prim_ids[i];
+                intersect_tri(m_precomputed_tris[j], i, mask, p);
+            }
+            ++num_nodes;
+            num_tests += (end-begin) * std::popcount(mask);
+        }
+        stats::add(stats::NodesVisited, num_nodes);
+        stats::add(stats::TriangleTests, num_tests);
+    }
+
+    [[nodiscard]] Eigen::Vector3f normal(size_t prim_id) const
+    {
+        auto &n = m_precomputed_tris[prim_id].n;
+        return -Eigen::Vector3f(n[0],n[1],n[2]).normalized();
+    }
+
+    [[nodiscard]] size_t node_memory() const
+    {
+        switch (layout) {
+            case BvhLayout::Wide4: return m_wide4.nodes.size() * sizeof(WideBvh<4>::Node);
+            case BvhLayout::Wide8: return m_wide8.nodes.size() * sizeof(WideBvh<8>::Node);
+            default: return m_bvh->nodes.size() * sizeof(::Node);
+        }
+    }
+
 private:
     std::unique_ptr<::Bvh> m_bvh;
+    WideBvh<4> m_wide4;
+    WideBvh<8> m_wide8;
 
     std::vector<::PrecomputedTri> m_precomputed_tris;
 
     // Permuting the primitive data allows to remove indirections during traversal, which makes it faster.
     const bool m_should_permute = true;
+
+    // refits that make the tree this much more expensive than when it was built trigger a rebuild
+    static constexpr float max_sah_degradation = 1.5f;
+    float m_built_cost = 0.f;
+
+    // nodes of the binary tree sorted by depth, level lv spans
+    // [m_level_offsets[lv], m_level_offsets[lv+1])
+    std::vector<size_t> m_level_nodes;
+    std::vector<size_t> m_level_offsets;
+
+    void build_levels()
+    {
+        const auto &nodes = m_bvh->nodes;
+        m_level_nodes.assign(1, 0);
+        m_level_offsets.assign({0, 1});
+        for (size_t lv = 0; m_level_offsets[lv+1] > m_level_offsets[lv]; ++lv) {
+            for (size_t i = m_level_offsets[lv]; i < m_level_offsets[lv+1]; ++i) {
+                const auto &node = nodes[m_level_nodes[i]];
+                if (node.is_leaf()) { continue; }
+                m_level_nodes.push_back(first_id(node.index));
+                m_level_nodes.push_back(first_id(node.index)+1);
+            }
+            m_level_offsets.push_back(m_level_nodes.size());
+        }
+        m_level_offsets.pop_back();
+    }
 };
 
 TriMesh::TriMesh(Eigen::MatrixXf V, Eigen::MatrixXi F)
         : m_refV(std::move(V)), m_F(std::move(F))
 {
     using namespace Eigen;
-    m_bvh = std::make_unique<BVH>(m_refV,m_F);
+    m_bvh = std::make_unique<BVH>(m_refV,m_F,m_layout);
+    m_local_bounds = AlignedBox3f(m_refV.colwise().minCoeff().transpose(), m_refV.colwise().maxCoeff().transpose());
 }
 
 TriMesh::~TriMesh() = default;
 
 void TriMesh::apply_transform()
+{
+    m_xform = Similarity(*this->transform);
+    touch();
+}
+
+void TriMesh::update_vertices(Eigen::MatrixXf V)
 {
     using namespace Eigen;
-    MatrixXf V = this->transform->scale * m_refV;
-    for (int ii = 0; ii < V.rows(); ++ii) {
-        V.row(ii) = this->transform->rot() * V.row(ii).transpose();
-        V.row(ii) += this->transform->shift;
+    assert(V.rows() == m_refV.rows());
+    m_refV = std::move(V);
+    m_local_bounds = AlignedBox3f(m_refV.colwise().minCoeff().transpose(), m_refV.colwise().maxCoeff().transpose());
+    if (!m_bvh->refit(m_refV, m_F)) {
+        m_bvh = std::make_unique<BVH>(m_refV,m_F,m_layout);
+    }
+    touch();
+}
+
+void TriMesh::set_bvh_layout(BvhLayout layout)
+{
+    if (layout == m_layout) { return; }
+    m_layout = layout;
+    m_bvh = std::make_unique<BVH>(m_refV,m_F,m_layout);
+}
+
+size_t TriMesh::bvh_memory() const
+{
+    return m_bvh->node_memory();
+}
+
+namespace {
+
+template<int N, typename BVH>
+int cast_packet(
+        const BVH &bvh,
+        const Ray *rays, Hit *hits, int n,
+        const Similarity &xf, int obj_id, int mat_id
+) {
+    static constexpr size_t invalid_id = std::numeric_limits<size_t>::max();
+    n = std::min(n, N);
+
+    RayPacket<N> p;
+    for (int k = 0; k < N; ++k) {
+        const bool active = k < n;
+        if (active) {
+            // the BVH is in the frame of the reference vertices
+            const Ray local = xf.to_local(rays[k]);
+            for (int a = 0; a < 3; ++a) {
+                p.org[a][k] = local.org[a];
+                p.dir[a][k] = local.dir[a];
+            }
+        } else {
+            for (int a = 0; a < 3; ++a) {
+                p.org[a][k] = 0.f;
+                p.dir[a][k] = 1.f;
+            }
+        }
+        for (int a = 0; a < 3; ++a) { p.inv_dir[a][k] = Scalar(1) / p.dir[a][k]; }
+        // closer hits found on other objects bound the traversal
+        p.tmin[k] = active ? rays[k].tmin : 1.f;
+        p.tmax[k] = active ? std::min(rays[k].tmax, hits[k].dist) : 0.f;
+        p.prim_id[k] = invalid_id;
+    }
+
+    bvh.ray_cast(p);
+
+    for (int k = 0; k < n; ++k) {
+        if (p.prim_id[k] == invalid_id) { continue; }
+        const float dist = p.tmax[k];
+        if (dist >= hits[k].dist) { continue; }
+        const Eigen::Vector3f nrm = xf.normal_to_world(bvh.normal(p.prim_id[k]));
+        auto &hit = hits[k];
+        hit.dist = dist;
+        hit.prim_id = int(p.prim_id[k]);
+        hit.nrm = nrm;
+        hit.pos = rays[k].org + dist * rays[k].dir + 1e-6f * nrm;
+        hit.wo = -rays[k].dir;
+        hit.obj_id = obj_id;
+        hit.mat_id = mat_id;
+    }
+    return n;
+}
+
+} // namespace
+
+void TriMesh::ray_cast_packet(const Ray *rays, Hit *hits, int n) const
+{
+    if (!this->visible) { return; }
+    ray_cast_packet(rays, hits, n, m_xform, this->obj_id, this->mat_id);
+}
+
+void TriMesh::ray_cast_packet(
+        const Ray *rays, Hit *hits, int n,
+        const Similarity &xf, int obj_id, int mat_id
+) const
+{
+    if (m_bvh->layout != BvhLayout::Binary) {
+        // packets are only traversed on the binary tree
+        for (int ii = 0; ii < n; ++ii) { ray_cast(rays[ii], hits[ii], xf, obj_id, mat_id); }
+        return;
+    }
+    while (n > 0) {
+        int done;
+        if (n > 8) { done = cast_packet<16>(*m_bvh, rays, hits, n, xf, obj_id, mat_id); }
+        else if (n > 4) { done = cast_packet<8>(*m_bvh, rays, hits, n, xf, obj_id, mat_id); }
+        else { done = cast_packet<4>(*m_bvh, rays, hits, n, xf, obj_id, mat_id); }
+        rays += done;
+        hits += done;
+        n -= done;
     }
-    m_bvh = std::make_unique<BVH>(V,m_F);
+}
+
+bool TriMesh::occluded(const Ray &ray) const
+{
+    if (!this->visible) { return false; }
+    return occluded(ray, m_xform);
+}
+
+bool TriMesh::occluded(const Ray &ray, const Similarity &xf) const
+{
+    return m_bvh->occluded(xf.to_local(ray));
 }
 
 void TriMesh::ray_cast(const Ray &ray, Hit &hit) const
 {
     if (!this->visible) { return; }
+    ray_cast(ray, hit, m_xform, this->obj_id, this->mat_id);
+}
+
+void TriMesh::ray_cast(const Ray &ray, Hit &hit, const Similarity &xf, int obj_id, int mat_id) const
+{
     size_t tri_id;
     float dist;
     Eigen::Vector3f nrm;
-    if (m_bvh->ray_cast(ray, tri_id, dist, nrm)) {
+    if (m_bvh->ray_cast(xf.to_local(ray), tri_id, dist, nrm)) {
         if (dist >= hit.dist) { return; }
+        nrm = xf.normal_to_world(nrm);
         hit.dist = dist;
         hit.prim_id = tri_id;
         hit.nrm = nrm;
         hit.pos = ray.org + dist* ray.dir + 1e-6f * nrm;
         hit.wo = -ray.dir;
-        hit.obj_id = this->obj_id;
-        hit.mat_id = this->mat_id;
+        hit.obj_id = obj_id;
+        hit.mat_id = mat_id;
     }
 }
 
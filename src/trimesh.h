@@ -9,6 +9,12 @@ namespace rtnpr {
 
 class TriMesh: public Object {
 public:
+    // branching factor of the acceleration structure; the wide trees store
+    // their child bounds quantized to 8 bits
+    enum class BvhLayout {
+        Binary = 2, Wide4 = 4, Wide8 = 8
+    };
+
     static std::shared_ptr<TriMesh> create(
             const Eigen::MatrixXf &V, const Eigen::MatrixXi &F
     ) {
@@ -19,11 +25,37 @@ public:
     ~TriMesh();
 
     void ray_cast(const Ray &ray, Hit &hit) const override;
+    void ray_cast_packet(const Ray *rays, Hit *hits, int n) const override;
+    [[nodiscard]] bool occluded(const Ray &ray) const override;
+
+    // Same as above but regardless of visibility, with the mesh placed by xf
+    // and the hits reported with the given ids. Lets instances trace the mesh
+    // under their own placement and ids.
+    void ray_cast(const Ray &ray, Hit &hit, const Similarity &xf, int obj_id, int mat_id) const;
+    void ray_cast_packet(const Ray *rays, Hit *hits, int n, const Similarity &xf, int obj_id, int mat_id) const;
+    [[nodiscard]] bool occluded(const Ray &ray, const Similarity &xf) const;
+
+    // Only updates the object-to-world transform, the BVH stays in the frame
+    // of the reference vertices.
     void apply_transform() override;
+    [[nodiscard]] Eigen::AlignedBox3f bounds() const override { return m_xform.to_world(m_local_bounds); }
+    [[nodiscard]] const Similarity &similarity() const { return m_xform; }
+
+    // Moves the reference vertices, keeping the faces. The BVH is refitted
+    // and only rebuilt once its quality has degraded too much. Instances of
+    // the mesh follow on the next Scene::commit.
+    void update_vertices(Eigen::MatrixXf V);
+
+    void set_bvh_layout(BvhLayout layout);
+    [[nodiscard]] BvhLayout bvh_layout() const { return m_layout; }
+    [[nodiscard]] size_t bvh_memory() const;
 
 private:
     class BVH;
     std::unique_ptr<BVH> m_bvh;
+    BvhLayout m_layout = BvhLayout::Binary;
+    Similarity m_xform;
+    Eigen::AlignedBox3f m_local_bounds;
 
     Eigen::MatrixXf m_refV;
     Eigen::MatrixXi m_F;
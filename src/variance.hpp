@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cmath>
+
+namespace rtnpr {
+
+// Mean and sum of squared deviations of a stream of samples, updated with
+// Welford's algorithm.
+struct Moments {
+    unsigned int n = 0;
+    float mean = 0.f;
+    float m2 = 0.f;
+
+    void add(float x)
+    {
+        ++n;
+        const float d = x - mean;
+        mean += d / float(n);
+        m2 += d * (x - mean);
+    }
+};
+
+// Sum of squared deviations of n_a samples of mean mean_a and sum m2_a
+// merged with the samples of b (Chan et al.).
+inline float merge_m2(float m2_a, float mean_a, unsigned int n_a, const Moments &b)
+{
+    if (b.n == 0) { return m2_a; }
+    const float d = b.mean - mean_a;
+    return m2_a + b.m2 + d * d * float(n_a) * float(b.n) / float(n_a + b.n);
+}
+
+// standard error of the mean of n samples with sum of squared deviations m2
+inline float standard_error(float m2, unsigned int n)
+{
+    if (n < 2) { return INFINITY; }
+    return std::sqrt(m2 / (float(n-1) * float(n)));
+}
+
+inline float luminance(float r, float g, float b)
+{
+    return .2126f * r + .7152f * g + .0722f * b;
+}
+
+} // namespace rtnpr
@@ -1,5 +1,8 @@
 #include "viewer.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <iostream>
 
@@ -17,6 +20,7 @@
 #include "delfem2/glfw/util.h"
 
 #include "raytracer.h"
+#include "frame_budget.hpp"
 #include "gui.h"
 
 namespace dfm2 = delfem2;
@@ -36,6 +40,8 @@ public:
 
     void InitGL(int _width, int _height, int _tex_width, int _tex_height)
     {
+        m_tex_width = _tex_width;
+        m_tex_height = _tex_height;
         m_tex.width = _tex_width;
         m_tex.height = _tex_height;
         m_tex.channels = 3;
@@ -57,7 +63,32 @@ public:
 
     void draw(RayTracer &rt, Gui &gui)
     {
-        rt.step(m_tex.pixel_color, m_tex.width, m_tex.height, camera, gui.opts);
+        if (gui.trace && !rt.tracing()) { rt.start_trace(); }
+        if (!gui.trace && rt.tracing()) {
+            if (rt.write_trace("rtnpr_trace.json")) { std::cout << "trace written to rtnpr_trace.json" << std::endl; }
+            else { std::cerr << "failed to write rtnpr_trace.json" << std::endl; }
+        }
+
+        // the camera counts as moving for a while after the last event, so
+        // that a slow drag does not bounce between the resolutions
+        const auto now = stats::Clock::now();
+        if (!m_last_camera || !(*m_last_camera == camera)) {
+            m_last_camera.emplace(camera);
+            m_last_move = now;
+        }
+        const bool moving = now - m_last_move < still_delay;
+        m_budget.update(rt.stats(), m_tex_width * m_tex_height, moving, gui.opts);
+
+        // the texture is stretched over the window, which upscales frames
+        // rendered at a lower resolution
+        m_tex.width = std::max(1u, unsigned(std::lround(m_budget.scale() * float(m_tex_width))));
+        m_tex.height = std::max(1u, unsigned(std::lround(m_budget.scale() * float(m_tex_height))));
+        if (gui.opts.view.budget) {
+            Options opts = gui.opts;
+            opts.rt.spp_frame = m_budget.spp_frame();
+            rt.step(m_tex.pixel_color, m_tex.width, m_tex.height, camera, opts);
+        }
+        else { rt.step(m_tex.pixel_color, m_tex.width, m_tex.height, camera, gui.opts); }
         m_tex.InitGL();
         //
         ::glfwMakeContextCurrent(this->window);
@@ -70,11 +101,16 @@ public:
         glBindTexture(GL_TEXTURE_2D, m_tex.id_tex);
         m_drawer.Draw(dfm2::CMat4f::Identity().data(),
                       dfm2::CMat4f::Identity().data());
-        gui.draw();
+        gui.draw(rt.stats());
         this->SwapBuffers();
         glfwPollEvents();
     }
 
+    void resolve(RayTracer &rt, const Gui &gui)
+    {
+        rt.resolve(m_tex.pixel_color, gui.opts);
+    }
+
     void CursorPosition(double xpos, double ypos) override
     {
         int width0, height0;
@@ -108,6 +144,15 @@ private:
     dfm2::opengl::Drawer_RectangleTex m_drawer;
     dfm2::opengl::CTexRGB_Rect2D m_tex;
 
+    // full resolution of the texture
+    unsigned int m_tex_width = 0;
+    unsigned int m_tex_height = 0;
+
+    static constexpr std::chrono::milliseconds still_delay{200};
+    std::optional<Camera> m_last_camera;
+    stats::Clock::time_point m_last_move;
+    FrameBudget m_budget;
+
 };
 
 Viewer::Viewer() : m_impl(std::make_unique<Impl>()) {}
@@ -117,7 +162,6 @@ void Viewer::open()
 {
     if (m_opened) { return; }
 
-    m_impl->camerachange_callbacks.emplace_back([this]{ this->m_rt.reset(); });
     m_impl->InitGL(width, height, tex_width, tex_height);
     m_opened = true;
 
@@ -134,6 +178,11 @@ void Viewer::open()
         {
             m_rt.reset();
         }
+        else if (gui.opts.needs_resolve)
+        {
+            // pixels done sampling are not written by step any more
+            m_impl->resolve(m_rt, gui);
+        }
     }
 }
 
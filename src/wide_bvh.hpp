@@ -0,0 +1,426 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE4_1__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace rtnpr {
+
+namespace bvh2 {
+
+// bvh v2 exposes the fields of a node index either as bitfields or, in later
+// versions, as accessors
+template<typename Index>
+size_t first_id(const Index &index)
+{
+    if constexpr (requires { index.first_id(); }) { return index.first_id(); }
+    else { return index.first_id; }
+}
+
+template<typename Index>
+size_t prim_count(const Index &index)
+{
+    if constexpr (requires { index.prim_count(); }) { return index.prim_count(); }
+    else { return index.prim_count; }
+}
+
+struct IgnoreArgs {
+    template<typename... Args>
+    void operator()(Args &&...) const {}
+};
+
+// Closest or any hit traversal of a binary tree from its root. Later versions
+// of bvh v2 call inner_fn on each inner node visited, older ones only report
+// the leaves.
+template<bool IsAnyHit, bool IsRobust, typename Bvh, typename Ray, typename Stack, typename LeafFn, typename InnerFn>
+void intersect(const Bvh &bvh, const Ray &ray, Stack &stack, LeafFn &&leaf_fn, InnerFn &&inner_fn)
+{
+    const auto root = bvh.get_root().index;
+    if constexpr (requires { bvh.template intersect<IsAnyHit, IsRobust>(ray, root, stack, leaf_fn, inner_fn); }) {
+        bvh.template intersect<IsAnyHit, IsRobust>(ray, root, stack, leaf_fn, inner_fn);
+    }
+    else {
+        bvh.template intersect<IsAnyHit, IsRobust>(ray, root, stack, leaf_fn);
+    }
+}
+
+} // namespace bvh2
+
+// W-wide BVH collapsed from a binary bvh v2 tree. The boxes of the children
+// of a node are quantized to 8 bits in a frame spanning the node
+// (Ylitie et al., "Efficient Incoherent Ray Traversal on GPUs Through
+// Compressed Wide BVHs", HPG 2017), and a ray is tested against all the
+// children of a node in one go.
+template<int W>
+class WideBvh {
+public:
+    static_assert(W == 4 || W == 8);
+
+    struct Node {
+        float origin[3];
+        uint32_t child[W];      // first primitive of a leaf, or index of an inner node
+        int8_t exponent[3];     // quantization step of each axis is 2^exponent
+        uint8_t num_children;
+        uint8_t prim_count[W];  // 0 for inner children
+        uint8_t lo[3][W];
+        uint8_t hi[3][W];
+    };
+
+    std::vector<Node> nodes;
+
+    template<typename BinaryBvh>
+    void build(const BinaryBvh &bvh)
+    {
+        nodes.clear();
+        m_cost = 0.f;
+        if (bvh.nodes.empty()) { return; }
+        float bmin[3], bmax[3];
+        collapse(bvh, 0, bmin, bmax);
+        nodes.shrink_to_fit();
+        m_cost /= half_area(bmin, bmax);
+        build_levels();
+    }
+
+    // SAH cost of the tree relative to the area of the root, updated by refit
+    [[nodiscard]] float sah_cost() const { return m_cost; }
+
+    // Recomputes the bounds of all the nodes bottom-up, keeping the topology.
+    // leaf_bounds(begin, end, lo, hi) gives the bounds of a range of
+    // primitives, and for_each(begin, end, loop) runs loop over sub-ranges of
+    // [begin,end), possibly in parallel.
+    template<typename LeafBounds, typename ForEach>
+    void refit(const LeafBounds &leaf_bounds, ForEach &&for_each)
+    {
+        if (nodes.empty()) { return; }
+        m_boxes.resize(nodes.size());
+        m_node_cost.resize(nodes.size());
+        // the nodes of a level only depend on the ones of deeper levels
+        for (size_t lv = m_level_offsets.size()-1; lv-- > 0;) {
+            for_each(m_level_offsets[lv], m_level_offsets[lv+1], [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) { refit_node(m_level_nodes[i], leaf_bounds); }
+            });
+        }
+        float cost = 0.f;
+        for (float c: m_node_cost) { cost += c; }
+        m_cost = cost / half_area(m_boxes[0].data(), m_boxes[0].data()+3);
+    }
+
+    // Finds the closest intersection. leaf_fn(begin, end) intersects the
+    // primitives of a leaf and shortens ray.tmax on a hit. With IsAnyHit the
+    // traversal stops as soon as leaf_fn returns true. inner_fn(node) is
+    // called on each inner node visited.
+    template<bool IsAnyHit, typename Ray, typename LeafFn, typename InnerFn = bvh2::IgnoreArgs>
+    void intersect(Ray &ray, LeafFn &&leaf_fn, InnerFn &&inner_fn = {}) const
+    {
+        if (nodes.empty()) { return; }
+
+        float org[3], inv_dir[3];
+        for (int a = 0; a < 3; ++a) {
+            // keep the slab distances finite for axis-aligned rays
+            static constexpr float eps = 1e-20f;
+            const float d = ray.dir[a];
+            org[a] = ray.org[a];
+            inv_dir[a] = std::abs(d) > eps ? 1.f / d : std::copysign(1.f / eps, d);
+        }
+
+        struct Entry { uint32_t id; uint32_t prim_count; float t; };
+        static constexpr int stack_size = 64 * (W-1) + 1;
+        Entry stack[stack_size];
+        int top = 0;
+        stack[top++] = {0, 0, ray.tmin};
+
+        while (top > 0) {
+            const Entry e = stack[--top];
+            if (e.t > ray.tmax) { continue; }
+            if (e.prim_count > 0) {
+                if (leaf_fn(size_t(e.id), size_t(e.id + e.prim_count)) && IsAnyHit) { return; }
+                continue;
+            }
+
+            const Node &node = nodes[e.id];
+            inner_fn(node);
+            float t0[W];
+            uint32_t mask = intersect_children(node, org, inv_dir, ray.tmin, ray.tmax, t0);
+
+            // push the children far to near so that the nearest one is popped first
+            int ids[W];
+            int cnt = 0;
+            while (mask) {
+                const int c = std::countr_zero(mask);
+                mask &= mask - 1;
+                int k = cnt++;
+                for (; k > 0 && t0[ids[k-1]] < t0[c]; --k) { ids[k] = ids[k-1]; }
+                ids[k] = c;
+            }
+            // at most W-1 entries left behind per level of a tree of depth 64
+            assert(top + cnt <= stack_size);
+            for (int k = 0; k < cnt; ++k) {
+                const int c = ids[k];
+                stack[top++] = {node.child[c], node.prim_count[c], t0[c]};
+            }
+        }
+    }
+
+private:
+    float m_cost = 0.f;
+
+    // node ids sorted by depth, level lv spans [m_level_offsets[lv], m_level_offsets[lv+1])
+    std::vector<uint32_t> m_level_nodes;
+    std::vector<size_t> m_level_offsets;
+
+    // scratch space of refit: exact bounds (min then max) and SAH cost of each node
+    std::vector<std::array<float,6>> m_boxes;
+    std::vector<float> m_node_cost;
+
+    static float half_area(const float lo[3], const float hi[3])
+    {
+        const float dx = hi[0]-lo[0], dy = hi[1]-lo[1], dz = hi[2]-lo[2];
+        return dx*dy + dy*dz + dz*dx;
+    }
+
+    static float exp2i(int e)
+    {
+        const uint32_t bits = uint32_t(e + 127) << 23;
+        float f;
+        std::memcpy(&f, &bits, sizeof(float));
+        return f;
+    }
+
+    static uint32_t intersect_children(
+            const Node &node,
+            const float org[3], const float inv_dir[3],
+            float tmin, float tmax,
+            float *t0
+    ) {
+        const uint32_t valid = (1u << node.num_children) - 1u;
+#if defined(__AVX2__)
+        if constexpr (W == 8) {
+            __m256 tlo = _mm256_set1_ps(tmin);
+            __m256 thi = _mm256_set1_ps(tmax);
+            for (int a = 0; a < 3; ++a) {
+                const float step = exp2i(node.exponent[a]) * inv_dir[a];
+                const __m256 base = _mm256_set1_ps((node.origin[a] - org[a]) * inv_dir[a]);
+                const __m256 vstep = _mm256_set1_ps(step);
+                const __m256 qlo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) node.lo[a])));
+                const __m256 qhi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) node.hi[a])));
+                const __m256 ta = _mm256_add_ps(base, _mm256_mul_ps(qlo, vstep));
+                const __m256 tb = _mm256_add_ps(base, _mm256_mul_ps(qhi, vstep));
+                tlo = _mm256_max_ps(tlo, _mm256_min_ps(ta, tb));
+                thi = _mm256_min_ps(thi, _mm256_max_ps(ta, tb));
+            }
+            _mm256_storeu_ps(t0, tlo);
+            return uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(tlo, thi, _CMP_LE_OQ))) & valid;
+        }
+#endif
+#if defined(__SSE4_1__)
+        if constexpr (W == 4) {
+            __m128 tlo = _mm_set1_ps(tmin);
+            __m128 thi = _mm_set1_ps(tmax);
+            for (int a = 0; a < 3; ++a) {
+                int32_t lo, hi;
+                std::memcpy(&lo, node.lo[a], sizeof(int32_t));
+                std::memcpy(&hi, node.hi[a], sizeof(int32_t));
+                const float step = exp2i(node.exponent[a]) * inv_dir[a];
+                const __m128 base = _mm_set1_ps((node.origin[a] - org[a]) * inv_dir[a]);
+                const __m128 vstep = _mm_set1_ps(step);
+                const __m128 qlo = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(lo)));
+                const __m128 qhi = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(hi)));
+                const __m128 ta = _mm_add_ps(base, _mm_mul_ps(qlo, vstep));
+                const __m128 tb = _mm_add_ps(base, _mm_mul_ps(qhi, vstep));
+                tlo = _mm_max_ps(tlo, _mm_min_ps(ta, tb));
+                thi = _mm_min_ps(thi, _mm_max_ps(ta, tb));
+            }
+            _mm_storeu_ps(t0, tlo);
+            return uint32_t(_mm_movemask_ps(_mm_cmple_ps(tlo, thi))) & valid;
+        }
+#endif
+        float thi[W];
+        for (int c = 0; c < W; ++c) {
+            t0[c] = tmin;
+            thi[c] = tmax;
+        }
+        for (int a = 0; a < 3; ++a) {
+            const float step = exp2i(node.exponent[a]) * inv_dir[a];
+            const float base = (node.origin[a] - org[a]) * inv_dir[a];
+            for (int c = 0; c < W; ++c) {
+                const float ta = base + float(node.lo[a][c]) * step;
+                const float tb = base + float(node.hi[a][c]) * step;
+                t0[c] = std::max(t0[c], std::min(ta, tb));
+                thi[c] = std::min(thi[c], std::max(ta, tb));
+            }
+        }
+        uint32_t mask = 0;
+        for (int c = 0; c < W; ++c) { mask |= uint32_t(t0[c] <= thi[c]) << c; }
+        return mask & valid;
+    }
+
+    // Collapses the binary subtree at bin_id, returns the id of the wide node
+    // and its bounds in bmin/bmax.
+    template<typename BinaryBvh>
+    uint32_t collapse(const BinaryBvh &bvh, size_t bin_id, float bmin[3], float bmax[3])
+    {
+        // open the largest inner child until the node has W children
+        size_t cand[W];
+        int n = 0;
+        if (bvh.nodes[bin_id].is_leaf()) {
+            cand[n++] = bin_id;
+        } else {
+            cand[n++] = bvh2::first_id(bvh.nodes[bin_id].index);
+            cand[n++] = cand[0] + 1;
+        }
+        while (n < W) {
+            int best = -1;
+            float best_area = -1.f;
+            for (int i = 0; i < n; ++i) {
+                const auto &child = bvh.nodes[cand[i]];
+                if (child.is_leaf()) { continue; }
+                const auto d = child.get_bbox().get_diagonal();
+                const float area = d[0]*d[1] + d[1]*d[2] + d[2]*d[0];
+                if (area > best_area) {
+                    best_area = area;
+                    best = i;
+                }
+            }
+            if (best < 0) { break; }
+            const size_t first = bvh2::first_id(bvh.nodes[cand[best]].index);
+            cand[best] = first;
+            cand[n++] = first + 1;
+        }
+
+        const auto id = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        float cmin[W][3], cmax[W][3];
+        for (int i = 0; i < n; ++i) {
+            const auto bbox = bvh.nodes[cand[i]].get_bbox();
+            for (int a = 0; a < 3; ++a) {
+                cmin[i][a] = bbox.min[a];
+                cmax[i][a] = bbox.max[a];
+            }
+        }
+
+        Node node{};
+        node.num_children = uint8_t(n);
+        quantize(node, cmin, cmax, bmin, bmax);
+
+        for (int i = 0; i < n; ++i) {
+            const auto &child = bvh.nodes[cand[i]];
+            if (child.is_leaf()) {
+                node.child[i] = uint32_t(bvh2::first_id(child.index));
+                node.prim_count[i] = uint8_t(bvh2::prim_count(child.index));
+            } else {
+                float lo[3], hi[3];
+                node.child[i] = collapse(bvh, cand[i], lo, hi);
+                node.prim_count[i] = 0;
+            }
+        }
+        m_cost += node_cost(node, cmin, cmax, bmin, bmax);
+        nodes[id] = node;
+        return id;
+    }
+
+    // Sets the frame of the node to the union of the child boxes, returned in
+    // bmin/bmax, and quantizes the child boxes in it.
+    static void quantize(
+            Node &node,
+            const float cmin[W][3], const float cmax[W][3],
+            float bmin[3], float bmax[3]
+    ) {
+        const int n = node.num_children;
+        for (int a = 0; a < 3; ++a) {
+            bmin[a] = std::numeric_limits<float>::max();
+            bmax[a] = -std::numeric_limits<float>::max();
+            for (int i = 0; i < n; ++i) {
+                bmin[a] = std::min(bmin[a], cmin[i][a]);
+                bmax[a] = std::max(bmax[a], cmax[i][a]);
+            }
+        }
+
+        for (int a = 0; a < 3; ++a) {
+            const float ext = bmax[a] - bmin[a];
+            int e = ext > 0.f ? int(std::ceil(std::log2(ext / 255.f))) : -100;
+            e = std::clamp(e, -100, 100);
+            if (bmin[a] + 255.f * exp2i(e) < bmax[a]) { ++e; }
+            const float scale = exp2i(e);
+            node.origin[a] = bmin[a];
+            node.exponent[a] = int8_t(e);
+
+            // round outwards so that the quantized boxes are conservative
+            for (int i = 0; i < W; ++i) {
+                if (i >= n) {
+                    node.lo[a][i] = 0;
+                    node.hi[a][i] = 0;
+                    continue;
+                }
+                int lo = std::clamp(int(std::floor((cmin[i][a] - bmin[a]) / scale)), 0, 255);
+                int hi = std::clamp(int(std::ceil((cmax[i][a] - bmin[a]) / scale)), 0, 255);
+                while (lo > 0 && bmin[a] + float(lo) * scale > cmin[i][a]) { --lo; }
+                while (hi < 255 && bmin[a] + float(hi) * scale < cmax[i][a]) { ++hi; }
+                node.lo[a][i] = uint8_t(lo);
+                node.hi[a][i] = uint8_t(hi);
+            }
+        }
+    }
+
+    // one traversal step for the node plus one intersection per primitive of its leaves
+    static float node_cost(
+            const Node &node,
+            const float cmin[W][3], const float cmax[W][3],
+            const float bmin[3], const float bmax[3]
+    ) {
+        float cost = half_area(bmin, bmax);
+        for (int i = 0; i < node.num_children; ++i) {
+            cost += float(node.prim_count[i]) * half_area(cmin[i], cmax[i]);
+        }
+        return cost;
+    }
+
+    template<typename LeafBounds>
+    void refit_node(uint32_t id, const LeafBounds &leaf_bounds)
+    {
+        Node &node = nodes[id];
+        float cmin[W][3], cmax[W][3];
+        for (int i = 0; i < node.num_children; ++i) {
+            if (node.prim_count[i] > 0) {
+                leaf_bounds(size_t(node.child[i]), size_t(node.child[i] + node.prim_count[i]), cmin[i], cmax[i]);
+            } else {
+                const auto &box = m_boxes[node.child[i]];
+                std::copy_n(box.data(), 3, cmin[i]);
+                std::copy_n(box.data()+3, 3, cmax[i]);
+            }
+        }
+        float bmin[3], bmax[3];
+        quantize(node, cmin, cmax, bmin, bmax);
+        std::copy_n(bmin, 3, m_boxes[id].data());
+        std::copy_n(bmax, 3, m_boxes[id].data()+3);
+        m_node_cost[id] = node_cost(node, cmin, cmax, bmin, bmax);
+    }
+
+    void build_levels()
+    {
+        m_level_nodes.assign(1, 0);
+        m_level_offsets.assign({0, 1});
+        for (size_t lv = 0; m_level_offsets[lv+1] > m_level_offsets[lv]; ++lv) {
+            for (size_t i = m_level_offsets[lv]; i < m_level_offsets[lv+1]; ++i) {
+                const Node &node = nodes[m_level_nodes[i]];
+                for (int c = 0; c < node.num_children; ++c) {
+                    if (node.prim_count[c] == 0) { m_level_nodes.push_back(node.child[c]); }
+                }
+            }
+            m_level_offsets.push_back(m_level_nodes.size());
+        }
+        m_level_offsets.pop_back();
+    }
+};
+
+} // namespace rtnpr
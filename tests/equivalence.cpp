@@ -0,0 +1,241 @@
+// Equivalence checks of the acceleration structures: every fast path has to
+// find the same hits as the plain one it replaces.
+//
+//   rtnpr_tests
+//
+// Returns non-zero and prints the failed checks if any mismatch is found.
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "instance.h"
+#include "plane.h"
+#include "sampler.hpp"
+#include "scene.h"
+#include "trimesh.h"
+#include "meshes.hpp"
+
+namespace {
+
+using namespace rtnpr;
+
+int failures = 0;
+
+void check(bool ok, const char *what, int mismatches)
+{
+    if (ok) { return; }
+    std::printf("FAILED %s: %d mismatches\n", what, mismatches);
+    ++failures;
+}
+
+// same object and distance, up to the precision of the triangle tests
+bool same_hit(const Hit &a, const Hit &b)
+{
+    if (a.obj_id != b.obj_id) { return false; }
+    if (a.obj_id < 0) { return true; }
+    return std::abs(a.dist - b.dist) <= 1e-4f * std::max(1.f, a.dist);
+}
+
+// rays from a sphere around the box towards random points in it
+std::vector<Ray> make_rays(const Eigen::Vector3f &lo, const Eigen::Vector3f &hi, int num_rays)
+{
+    const Eigen::Vector3f cen = .5f * (lo + hi);
+    const float radius = (hi - lo).norm();
+
+    std::vector<Ray> rays;
+    rays.reserve(num_rays);
+    for (int ii = 0; ii < num_rays; ++ii) {
+        UniformSampler<float> sampler(SamplerType::Random, 0, uint32_t(ii), 0, 0);
+        const float z = 2.f * sampler.sample() - 1.f;
+        const float phi = 2.f * float(M_PI) * sampler.sample();
+        const float rxy = std::sqrt(std::max(0.f, 1.f - z*z));
+        const Eigen::Vector3f org = cen + radius * Eigen::Vector3f(rxy*std::cos(phi), rxy*std::sin(phi), z);
+        Eigen::Vector3f tar;
+        for (int a = 0; a < 3; ++a) { tar[a] = lo[a] + (hi[a] - lo[a]) * sampler.sample(); }
+        rays.emplace_back(org, (tar - org).normalized());
+    }
+    return rays;
+}
+
+std::vector<Hit> trace_single(const Object &obj, const std::vector<Ray> &rays)
+{
+    std::vector<Hit> hits(rays.size());
+    for (size_t ii = 0; ii < rays.size(); ++ii) { obj.ray_cast(rays[ii], hits[ii]); }
+    return hits;
+}
+
+// in packets of varying sizes, so that partial packets are covered as well
+template<typename Cast>
+std::vector<Hit> trace_packets(Cast &&cast, const std::vector<Ray> &rays)
+{
+    std::vector<Hit> hits(rays.size());
+    size_t begin = 0;
+    for (int n = 1; begin < rays.size(); n = n % 16 + 1) {
+        const int cnt = int(std::min(rays.size() - begin, size_t(n)));
+        cast(rays.data() + begin, hits.data() + begin, cnt);
+        begin += cnt;
+    }
+    return hits;
+}
+
+int count_mismatches(const std::vector<Hit> &a, const std::vector<Hit> &b)
+{
+    int cnt = 0;
+    for (size_t ii = 0; ii < a.size(); ++ii) { cnt += !same_hit(a[ii], b[ii]); }
+    return cnt;
+}
+
+void check_mismatches(const std::vector<Hit> &a, const std::vector<Hit> &b, const char *what)
+{
+    const int cnt = count_mismatches(a, b);
+    check(cnt == 0, what, cnt);
+}
+
+const char *layout_name(TriMesh::BvhLayout layout)
+{
+    switch (layout) {
+        case TriMesh::BvhLayout::Binary: return "binary";
+        case TriMesh::BvhLayout::Wide4: return "wide4";
+        case TriMesh::BvhLayout::Wide8: return "wide8";
+    }
+    return "";
+}
+
+// packets and the wide layouts against single rays through the binary BVH
+void check_layouts(const Eigen::MatrixXf &V, const Eigen::MatrixXi &F, const std::vector<Ray> &rays)
+{
+    auto mesh = TriMesh::create(V, F);
+    const std::vector<Hit> ref = trace_single(*mesh, rays);
+
+    for (auto layout: {TriMesh::BvhLayout::Binary, TriMesh::BvhLayout::Wide4, TriMesh::BvhLayout::Wide8}) {
+        mesh->set_bvh_layout(layout);
+        char what[64];
+        std::snprintf(what, sizeof(what), "%s single rays", layout_name(layout));
+        check_mismatches(ref, trace_single(*mesh, rays), what);
+
+        std::snprintf(what, sizeof(what), "%s packets", layout_name(layout));
+        check_mismatches(ref, trace_packets([&](const Ray *r, Hit *h, int n) { mesh->ray_cast_packet(r, h, n); }, rays), what);
+
+        int occluded = 0;
+        for (size_t ii = 0; ii < rays.size(); ++ii) { occluded += mesh->occluded(rays[ii]) != (ref[ii].obj_id >= 0); }
+        std::snprintf(what, sizeof(what), "%s any-hit", layout_name(layout));
+        check(occluded == 0, what, occluded);
+    }
+}
+
+// a refitted BVH has to stay conservative: it finds what a fresh build does
+void check_refit(const Eigen::MatrixXf &V, const Eigen::MatrixXi &F, const std::vector<Ray> &rays)
+{
+    Eigen::MatrixXf V1 = V;
+    for (int ii = 0; ii < V1.rows(); ++ii) {
+        const Eigen::Vector3f p = V1.row(ii);
+        V1.row(ii) = p * (1.f + .2f * std::sin(5.f * p.x()) * std::cos(3.f * p.z()));
+    }
+
+    for (auto layout: {TriMesh::BvhLayout::Binary, TriMesh::BvhLayout::Wide4, TriMesh::BvhLayout::Wide8}) {
+        auto mesh = TriMesh::create(V, F);
+        mesh->set_bvh_layout(layout);
+        mesh->update_vertices(V1);
+
+        auto fresh = TriMesh::create(V1, F);
+        fresh->set_bvh_layout(layout);
+
+        char what[64];
+        std::snprintf(what, sizeof(what), "%s refit", layout_name(layout));
+        check_mismatches(trace_single(*fresh, rays), trace_single(*mesh, rays), what);
+    }
+}
+
+void check_scene(const Scene &scene, const std::vector<std::shared_ptr<Object>> &objects, const char *name)
+{
+    const std::vector<Ray> rays = make_rays(Eigen::Vector3f(-5.f, -2.f, -2.f), Eigen::Vector3f(5.f, 5.f, 2.f), 20000);
+    auto linear = [&](const Ray &ray) {
+        Hit hit;
+        for (const auto &obj: objects) { obj->ray_cast(ray, hit); }
+        return hit;
+    };
+
+    std::vector<Hit> ref(rays.size()), hits(rays.size());
+    for (size_t ii = 0; ii < rays.size(); ++ii) {
+        ref[ii] = linear(rays[ii]);
+        scene.ray_cast(rays[ii], hits[ii]);
+    }
+    char what[64];
+    std::snprintf(what, sizeof(what), "%s single rays", name);
+    check_mismatches(ref, hits, what);
+
+    std::snprintf(what, sizeof(what), "%s packets", name);
+    check_mismatches(ref, trace_packets([&](const Ray *r, Hit *h, int n) { scene.ray_cast_packet(r, h, n); }, rays), what);
+
+    int occluded = 0;
+    for (size_t ii = 0; ii < rays.size(); ++ii) { occluded += scene.occluded(rays[ii]) != (ref[ii].obj_id >= 0); }
+    std::snprintf(what, sizeof(what), "%s any-hit", name);
+    check(occluded == 0, what, occluded);
+}
+
+// the TLAS of a scene of instances and a plane against a scan over its
+// objects, before and after the instanced mesh is deformed and moved
+void check_tlas(const Eigen::MatrixXf &V, const Eigen::MatrixXi &F)
+{
+    auto mesh = TriMesh::create(V, F);
+    mesh->visible = false;
+
+    Scene scene;
+    std::vector<std::shared_ptr<Object>> objects;
+    auto add = [&](std::shared_ptr<Object> obj) {
+        objects.push_back(obj);
+        scene.add(std::move(obj));
+    };
+    add(mesh);
+    for (int ii = 0; ii < 6; ++ii) {
+        auto inst = Instance::create(mesh);
+        inst->transform->shift = Eigen::Vector3f(3.f * float(ii % 3) - 3.f, 3.f * float(ii / 3), 0.f);
+        inst->transform->scale = .5f + .25f * float(ii);
+        inst->apply_transform();
+        add(inst);
+    }
+    auto plane = Plane::create();
+    plane->transform->shift = Eigen::Vector3f(0.f, 0.f, -1.5f);
+    plane->apply_transform();
+    add(plane);
+    scene.commit();
+
+    check_scene(scene, objects, "tlas");
+
+    // the instances have to follow: their old boxes would miss the bulges
+    Eigen::MatrixXf V1 = V;
+    for (int ii = 0; ii < V1.rows(); ++ii) {
+        const Eigen::Vector3f p = V1.row(ii);
+        V1.row(ii) = p * (1.3f + .3f * std::sin(4.f * p.y()));
+    }
+    mesh->update_vertices(V1);
+    scene.commit();
+    check_scene(scene, objects, "tlas after update_vertices");
+
+    mesh->transform->angle_axis = Eigen::Vector3f(.3f, .5f, 0.f);
+    mesh->transform->shift = Eigen::Vector3f(0.f, .5f, .2f);
+    mesh->apply_transform();
+    scene.commit();
+    check_scene(scene, objects, "tlas after mesh apply_transform");
+}
+
+} // namespace
+
+int main()
+{
+    Eigen::MatrixXf V;
+    Eigen::MatrixXi F;
+    bench::make_bumpy_sphere(64, V, F);
+    const std::vector<Ray> rays = make_rays(V.colwise().minCoeff(), V.colwise().maxCoeff(), 20000);
+
+    check_layouts(V, F, rays);
+    check_refit(V, F, rays);
+    check_tlas(V, F);
+
+    if (failures == 0) { std::printf("all checks passed\n"); }
+    return failures == 0 ? 0 : 1;
+}